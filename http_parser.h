@@ -0,0 +1,479 @@
+/*
+ * Incremental HTTP/1.x request head parser.
+ *
+ * The parser is fed the bytes of a request as they are received: it keeps
+ * its position between calls so that every byte is looked at only once,
+ * however the request is fragmented, and it only records offsets into the
+ * caller's buffer, it never allocates nor copies.
+ *
+ * Does not depend on the kernel, so that it can be built and exercised in
+ * userspace as well.
+ * */
+#ifndef HTTP_PARSER_H
+#define HTTP_PARSER_H
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#else
+#include <stdbool.h>
+#include <stddef.h>
+#endif
+
+enum http_parse_status {
+	HTTP_PARSE_AGAIN,
+	HTTP_PARSE_DONE,
+	HTTP_PARSE_ERROR,
+};
+
+enum http_parser_state {
+	HTTP_STATE_METHOD,
+	HTTP_STATE_PATH,
+	HTTP_STATE_VERSION,
+	HTTP_STATE_VERSION_MINOR,
+	HTTP_STATE_REQUEST_LINE_END,
+	HTTP_STATE_LF,
+	HTTP_STATE_HEADER_START,
+	HTTP_STATE_HEADER_NAME,
+	HTTP_STATE_HEADER_VALUE,
+	HTTP_STATE_CONNECTION_VALUE,
+	HTTP_STATE_CAPTURED_VALUE,
+	HTTP_STATE_CONTENT_LENGTH_VALUE,
+	HTTP_STATE_HEAD_END_LF,
+};
+
+enum http_connection {
+	HTTP_CONNECTION_UNSET,
+	HTTP_CONNECTION_KEEP_ALIVE,
+	HTTP_CONNECTION_CLOSE,
+};
+
+/*
+ * Headers the parser looks at, the value of the conditional ones and of
+ * Accept-Encoding is captured for the caller to evaluate. Content-Length
+ * and Transfer-Encoding tell whether the request has a body.
+ * */
+enum http_header {
+	HTTP_HEADER_CONNECTION,
+	HTTP_HEADER_IF_NONE_MATCH,
+	HTTP_HEADER_IF_MODIFIED_SINCE,
+	HTTP_HEADER_ACCEPT_ENCODING,
+	HTTP_HEADER_CONTENT_LENGTH,
+	HTTP_HEADER_TRANSFER_ENCODING,
+};
+
+static const char * const http_header_names[] = {
+	[HTTP_HEADER_CONNECTION] = "connection",
+	[HTTP_HEADER_IF_NONE_MATCH] = "if-none-match",
+	[HTTP_HEADER_IF_MODIFIED_SINCE] = "if-modified-since",
+	[HTTP_HEADER_ACCEPT_ENCODING] = "accept-encoding",
+	[HTTP_HEADER_CONTENT_LENGTH] = "content-length",
+	[HTTP_HEADER_TRANSFER_ENCODING] = "transfer-encoding",
+};
+
+#define HTTP_ALL_HEADERS \
+	((1U << (sizeof(http_header_names) / \
+		sizeof(http_header_names[0]))) - 1)
+
+/*
+ * Tokens of the Connection header, indexed by enum http_connection - 1.
+ * */
+static const char * const http_connection_tokens[] = {
+	"keep-alive",
+	"close",
+};
+
+#define HTTP_ALL_CONNECTION_TOKENS \
+	((1U << (sizeof(http_connection_tokens) / \
+		sizeof(http_connection_tokens[0]))) - 1)
+
+#define HTTP_NO_MATCH (~0U)
+
+/*
+ * Content-Length values are saturated, the parser only needs to tell
+ * whether there is a body. */
+#define HTTP_CONTENT_LENGTH_MAX ((int)(~0U >> 1))
+
+/*
+ * A header value without its surrounding whitespace, len is 0 if the
+ * header is absent.
+ * */
+struct http_span {
+	unsigned int off;
+	unsigned int len;
+};
+
+/*
+ * All the offsets are relative to the start of the request.
+ *
+ * content_length is -1 without a Content-Length header, transfer_encoding
+ * is set if there is a Transfer-Encoding one, whatever its value. The
+ * parser does not delimit bodies, a caller which does not read them must
+ * not parse what follows a request having one as the next request.
+ * */
+struct http_parser {
+	enum http_parser_state state;
+	unsigned int off;
+	unsigned int method_len;
+	unsigned int path_off;
+	unsigned int path_len;
+	unsigned int version_minor;
+	enum http_connection connection;
+	struct http_span if_none_match;
+	struct http_span if_modified_since;
+	struct http_span accept_encoding;
+	int content_length;
+	bool transfer_encoding;
+
+	/*
+	 * Position in the header name or Connection token being matched
+	 * and the names or tokens still matching, the header whose value
+	 * is being captured. */
+	unsigned int match;
+	unsigned int candidates;
+	struct http_span *capture;
+};
+
+static inline void http_parser_init(struct http_parser *p) {
+	p->state = HTTP_STATE_METHOD;
+	p->off = 0;
+	p->method_len = 0;
+	p->path_off = 0;
+	p->path_len = 0;
+	p->version_minor = 0;
+	p->connection = HTTP_CONNECTION_UNSET;
+	p->if_none_match.len = 0;
+	p->if_modified_since.len = 0;
+	p->accept_encoding.len = 0;
+	p->content_length = -1;
+	p->transfer_encoding = false;
+	p->match = 0;
+	p->candidates = 0;
+	p->capture = NULL;
+}
+
+/*
+ * Whether the connection persists after the parsed request: HTTP/1.1
+ * unless "Connection: close", HTTP/1.0 only with "Connection: keep-alive".
+ * "close" wins over "keep-alive" whatever their order.
+ * */
+static inline bool http_parser_keep_alive(const struct http_parser *p) {
+	if(p->connection != HTTP_CONNECTION_UNSET) {
+		return p->connection == HTTP_CONNECTION_KEEP_ALIVE;
+	}
+
+	return p->version_minor > 0;
+}
+
+static inline bool http_is_tchar(unsigned char c) {
+	if((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+			(c >= '0' && c <= '9')) {
+		return true;
+	}
+
+	switch(c) {
+	case '!': case '#': case '$': case '%': case '&': case '\'':
+	case '*': case '+': case '-': case '.': case '^': case '_':
+	case '`': case '|': case '~':
+		return true;
+	}
+
+	return false;
+}
+
+static inline bool http_is_ctl(unsigned char c) {
+	return (c < ' ' && c != '\t') || c == 0x7f;
+}
+
+static inline unsigned char http_lower(unsigned char c) {
+	return (c >= 'A' && c <= 'Z') ? c | 0x20 : c;
+}
+
+/*
+ * Matches the header name against http_header_names, and picks the state
+ * parsing its value. */
+static inline enum http_parse_status http_parse_header_name(
+		struct http_parser *p, unsigned char c) {
+	unsigned int i, header = HTTP_NO_MATCH;
+
+	if(c == ':') {
+		for(i = 0; p->candidates >> i; i++) {
+			if((p->candidates & (1U << i)) &&
+					!http_header_names[i][p->match]) {
+				header = i;
+			}
+		}
+
+		switch(header) {
+		case HTTP_HEADER_CONNECTION:
+			p->match = 0;
+			p->candidates = HTTP_ALL_CONNECTION_TOKENS;
+			p->state = HTTP_STATE_CONNECTION_VALUE;
+			break;
+		case HTTP_HEADER_IF_NONE_MATCH:
+			p->capture = &p->if_none_match;
+			p->capture->len = 0;
+			p->state = HTTP_STATE_CAPTURED_VALUE;
+			break;
+		case HTTP_HEADER_IF_MODIFIED_SINCE:
+			p->capture = &p->if_modified_since;
+			p->capture->len = 0;
+			p->state = HTTP_STATE_CAPTURED_VALUE;
+			break;
+		case HTTP_HEADER_ACCEPT_ENCODING:
+			p->capture = &p->accept_encoding;
+			p->capture->len = 0;
+			p->state = HTTP_STATE_CAPTURED_VALUE;
+			break;
+		case HTTP_HEADER_CONTENT_LENGTH:
+			/*
+			 * Several lengths could frame the body differently
+			 * for different readers. */
+			if(p->content_length >= 0) {
+				return HTTP_PARSE_ERROR;
+			}
+			p->match = 0;
+			p->content_length = 0;
+			p->state = HTTP_STATE_CONTENT_LENGTH_VALUE;
+			break;
+		case HTTP_HEADER_TRANSFER_ENCODING:
+			p->transfer_encoding = true;
+			p->state = HTTP_STATE_HEADER_VALUE;
+			break;
+		default:
+			p->state = HTTP_STATE_HEADER_VALUE;
+		}
+		return HTTP_PARSE_AGAIN;
+	}
+
+	if(!http_is_tchar(c)) {
+		return HTTP_PARSE_ERROR;
+	}
+
+	for(i = 0; p->candidates >> i; i++) {
+		if((p->candidates & (1U << i)) &&
+				http_header_names[i][p->match] != http_lower(c)) {
+			p->candidates &= ~(1U << i);
+		}
+	}
+	p->match++;
+
+	return HTTP_PARSE_AGAIN;
+}
+
+/*
+ * Records the span of the value in p->capture, the last occurrence of a
+ * header wins. */
+static inline enum http_parse_status http_parse_captured_value(
+		struct http_parser *p, unsigned char c) {
+	if(c == '\r') {
+		p->state = HTTP_STATE_LF;
+	} else if(http_is_ctl(c)) {
+		return HTTP_PARSE_ERROR;
+	} else if(c != ' ' && c != '\t') {
+		if(p->capture->len == 0) {
+			p->capture->off = p->off;
+		}
+		p->capture->len = p->off + 1 - p->capture->off;
+	}
+
+	return HTTP_PARSE_AGAIN;
+}
+
+/*
+ * Parses the decimal value of Content-Length, surrounded by optional
+ * whitespace. p->match is 0 before the digits, 1 in them and 2 after. */
+static inline enum http_parse_status http_parse_content_length(
+		struct http_parser *p, unsigned char c) {
+	if(c == ' ' || c == '\t') {
+		if(p->match == 1) {
+			p->match = 2;
+		}
+	} else if(c == '\r') {
+		if(p->match == 0) {
+			return HTTP_PARSE_ERROR;
+		}
+		p->state = HTTP_STATE_LF;
+	} else if(c >= '0' && c <= '9' && p->match < 2) {
+		p->match = 1;
+		if(p->content_length > (HTTP_CONTENT_LENGTH_MAX - 9) / 10) {
+			p->content_length = HTTP_CONTENT_LENGTH_MAX;
+		} else {
+			p->content_length = p->content_length * 10 + c - '0';
+		}
+	} else {
+		return HTTP_PARSE_ERROR;
+	}
+
+	return HTTP_PARSE_AGAIN;
+}
+
+/*
+ * Matches the comma separated tokens of the Connection header. "close" is
+ * sticky, once seen a later "keep-alive" does not override it. */
+static inline enum http_parse_status http_parse_connection(
+		struct http_parser *p, unsigned char c) {
+	const char *token;
+	unsigned int i;
+
+	if(c == ',' || c == ' ' || c == '\t' || c == '\r') {
+		for(i = 0; p->match > 0 && p->candidates >> i; i++) {
+			token = http_connection_tokens[i];
+			if((p->candidates & (1U << i)) && !token[p->match] &&
+					p->connection != HTTP_CONNECTION_CLOSE) {
+				p->connection = i + 1;
+			}
+		}
+
+		p->match = 0;
+		p->candidates = HTTP_ALL_CONNECTION_TOKENS;
+		if(c == '\r') {
+			p->state = HTTP_STATE_LF;
+		}
+		return HTTP_PARSE_AGAIN;
+	}
+
+	if(http_is_ctl(c)) {
+		return HTTP_PARSE_ERROR;
+	}
+
+	for(i = 0; p->candidates >> i; i++) {
+		token = http_connection_tokens[i];
+		if((p->candidates & (1U << i)) &&
+				token[p->match] != http_lower(c)) {
+			p->candidates &= ~(1U << i);
+		}
+	}
+	p->match++;
+
+	return HTTP_PARSE_AGAIN;
+}
+
+/*
+ * Parses the request head starting at @buf, of which @len bytes have
+ * been received so far. Parsing resumes at p->off, where the previous
+ * call stopped, hence @buf must keep the bytes already parsed.
+ *
+ * Returns HTTP_PARSE_DONE once the head is complete, p->off is then the
+ * length of the head, HTTP_PARSE_AGAIN if more bytes are needed and
+ * HTTP_PARSE_ERROR on malformed input.
+ * */
+static inline enum http_parse_status http_parse(struct http_parser *p,
+		const char *buf, unsigned int len) {
+	enum http_parse_status ret = HTTP_PARSE_AGAIN;
+	unsigned char c;
+
+	for(; p->off < len; p->off++) {
+		c = buf[p->off];
+
+		switch(p->state) {
+		case HTTP_STATE_METHOD:
+			if(c == ' ' && p->off > 0) {
+				p->method_len = p->off;
+				p->path_off = p->off + 1;
+				p->state = HTTP_STATE_PATH;
+			} else if(!http_is_tchar(c)) {
+				return HTTP_PARSE_ERROR;
+			}
+			break;
+
+		case HTTP_STATE_PATH:
+			if(c == ' ' && p->off > p->path_off) {
+				p->path_len = p->off - p->path_off;
+				p->match = 0;
+				p->state = HTTP_STATE_VERSION;
+			} else if(c <= ' ' || c >= 0x7f) {
+				return HTTP_PARSE_ERROR;
+			}
+			break;
+
+		case HTTP_STATE_VERSION:
+			if(c != "HTTP/1."[p->match]) {
+				return HTTP_PARSE_ERROR;
+			}
+			if(++p->match == sizeof("HTTP/1.") - 1) {
+				p->state = HTTP_STATE_VERSION_MINOR;
+			}
+			break;
+
+		case HTTP_STATE_VERSION_MINOR:
+			if(c < '0' || c > '9') {
+				return HTTP_PARSE_ERROR;
+			}
+			p->version_minor = c - '0';
+			p->state = HTTP_STATE_REQUEST_LINE_END;
+			break;
+
+		case HTTP_STATE_REQUEST_LINE_END:
+			if(c != '\r') {
+				return HTTP_PARSE_ERROR;
+			}
+			p->state = HTTP_STATE_LF;
+			break;
+
+		case HTTP_STATE_LF:
+			if(c != '\n') {
+				return HTTP_PARSE_ERROR;
+			}
+			p->state = HTTP_STATE_HEADER_START;
+			break;
+
+		case HTTP_STATE_HEADER_START:
+			if(c == '\r') {
+				p->state = HTTP_STATE_HEAD_END_LF;
+				break;
+			}
+
+			/*
+			 * Obsolete line folding and empty names are refused.
+			 * */
+			if(!http_is_tchar(c)) {
+				return HTTP_PARSE_ERROR;
+			}
+
+			p->match = 0;
+			p->candidates = HTTP_ALL_HEADERS;
+			p->state = HTTP_STATE_HEADER_NAME;
+			ret = http_parse_header_name(p, c);
+			break;
+
+		case HTTP_STATE_HEADER_NAME:
+			ret = http_parse_header_name(p, c);
+			break;
+
+		case HTTP_STATE_HEADER_VALUE:
+			if(c == '\r') {
+				p->state = HTTP_STATE_LF;
+			} else if(http_is_ctl(c)) {
+				return HTTP_PARSE_ERROR;
+			}
+			break;
+
+		case HTTP_STATE_CONNECTION_VALUE:
+			ret = http_parse_connection(p, c);
+			break;
+
+		case HTTP_STATE_CAPTURED_VALUE:
+			ret = http_parse_captured_value(p, c);
+			break;
+
+		case HTTP_STATE_CONTENT_LENGTH_VALUE:
+			ret = http_parse_content_length(p, c);
+			break;
+
+		case HTTP_STATE_HEAD_END_LF:
+			if(c != '\n') {
+				return HTTP_PARSE_ERROR;
+			}
+			p->off++;
+			return HTTP_PARSE_DONE;
+		}
+
+		if(ret != HTTP_PARSE_AGAIN) {
+			return ret;
+		}
+	}
+
+	return HTTP_PARSE_AGAIN;
+}
+
+#endif
@@ -0,0 +1,1154 @@
+/*
+ * The server model: the versions of the served content, the client read
+ * section, the updater and the shadow copy recovery of "/".
+ *
+ * Shared by the kernel module and the userspace build on liburcu, which
+ * maps the few kernel facilities used here onto liburcu and pthreads
+ * (userspace/kernel_compat.h), so that both run the same code.
+ *
+ * The includer defines, before including this header:
+ *
+ * - struct web_data_render, what a version is rendered into
+ * - struct server, with at least content, state and update_timestamp, and
+ *   the server itself
+ * - the tunables time_to_recover, recovery_expedited, reclaim_backlog_max
+ *   and update_batch, at least 1
+ * - trace_response_sent(), trace_recovery_response() and
+ *   trace_web_data_updated()
+ *
+ * and, anywhere in the file, alloc_web_data(), free_web_data_now(),
+ * render_web_data() and the synchronization backend sync_ops points to.
+ * */
+#ifndef HTTP_SERVER_MODEL_H
+#define HTTP_SERVER_MODEL_H
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#include <linux/atomic.h>
+#include <linux/delay.h>
+#include <linux/jhash.h>
+#include <linux/jump_label.h>
+#include <linux/mutex.h>
+#include <linux/percpu.h>
+#include <linux/printk.h>
+#include <linux/rcupdate.h>
+#include <linux/sched/clock.h>
+#include <linux/slab.h>
+#include <linux/srcu.h>
+#include <linux/wait.h>
+#else
+#include "userspace/kernel_compat.h"
+#endif
+
+#define HTTP_PATH_MAX 64
+#define LATENCY_BUCKETS 32
+#define CONTENT_FANOUT_SHIFT 6
+#define CONTENT_FANOUT (1 << CONTENT_FANOUT_SHIFT)
+
+/*
+ * Larger values of update_batch are capped, so that the updates kept
+ * pending and the message of "/" do not wrap around. */
+#define UPDATE_BATCH_MAX 1024U
+
+struct state {
+	bool is_in_recovery;
+	struct rcu_head rcu;
+};
+
+struct time {
+	int time;
+};
+
+/*
+ * A version of a served resource, hashed by path in server.content.
+ *
+ * key points into path so that lookups can use the path of a request
+ * where it was received. render is what the version is served as, built
+ * once by render_web_data() before it is published. Versions are never
+ * modified once published, a new version replaces the previous one in
+ * the next generation.
+ *
+ * version is the generation the version was published in.
+ *
+ * message is only used by "/", the document maintained by the updater
+ * and repaired by the recovery thread.
+ * */
+struct web_data_key {
+	const char *path;
+	unsigned int len;
+};
+
+struct web_data {
+	struct web_data_key key;
+	char path[HTTP_PATH_MAX];
+	int message;
+	u64 version;
+	struct web_data_render render;
+	struct rcu_head rcu;
+};
+
+/*
+ * A generation of the whole content set.
+ *
+ * Resources are hashed by path into a two level tree: CONTENT_FANOUT
+ * directories of CONTENT_FANOUT leaves, a leaf being the array of the
+ * versions in its bucket. Every node is immutable once published, a
+ * transaction copies the root and the directories and leaves on the path
+ * to the resources it changes, shares everything else with the previous
+ * generation, and publishes the new root with a single
+ * rcu_assign_pointer(). Readers which dereference server.content once
+ * hence see one consistent generation.
+ *
+ * Once replaced, a generation carries in retired the nodes and versions
+ * which only it used, chained through their rcu_head, and they are all
+ * reclaimed by the single RCU callback of the generation. nr_retired
+ * counts the versions among them.
+ * */
+struct content_leaf {
+	struct rcu_head rcu;
+	unsigned int nr;
+	struct web_data *entries[];
+};
+
+struct content_dir {
+	struct rcu_head rcu;
+	struct content_leaf *leaves[CONTENT_FANOUT];
+};
+
+struct content_set {
+	struct rcu_head rcu;
+	u64 generation;
+	struct rcu_head *retired;
+	unsigned int nr_retired;
+	struct content_dir *dirs[CONTENT_FANOUT];
+};
+
+/*
+ * Statistics, kept per CPU so that counting never bounces a cache line
+ * between readers. The per CPU copies are only summed up when they are
+ * reported.
+ *
+ * read_latency[i] counts the read sections which lasted [2^i, 2^(i+1)) ns.
+ *
+ * The recovery counters are indexed by whether the grace period was
+ * expedited: the time spent from its start until recovery could publish,
+ * and the whole 438 window, in ns.
+ * */
+struct http_stats {
+	u64 normal_responses;
+	u64 recovery_responses;
+	u64 not_modified_responses;
+	u64 coded_responses;
+	u64 updates;
+	u64 recoveries;
+	u64 alloc_failures;
+	u64 coalesced_updates;
+	u64 backlog_waits;
+	u64 recovery_gps[2];
+	u64 recovery_gp_ns[2];
+	u64 recovery_window_ns[2];
+	u64 read_latency[LATENCY_BUCKETS];
+};
+
+/*
+ * Synchronization backends.
+ *
+ * Every access to "/" goes through sync_ops, so that the same clients,
+ * updater, benchmark and statistics can be run with RCU and with
+ * traditional reader-writer primitives.
+ *
+ * Readers run between read_lock() and read_unlock() and must redo the
+ * whole section while read_unlock() returns true. Writers publish under
+ * write_lock().
+ *
+ * cond_synchronize() returns once all the readers which started before
+ * the matching start_synchronize() are done, without waiting if that
+ * already happened meanwhile, so that work which does not need this
+ * guarantee can run in between. With expedited, the backends which can
+ * trade CPU disturbance for latency do so.
+ * */
+struct sync_read_ctx {
+	unsigned int seq;
+};
+
+struct sync_ops {
+	const char	*name;
+	void		(*read_lock)(struct sync_read_ctx *ctx);
+	bool		(*read_unlock)(struct sync_read_ctx *ctx);
+	void		(*write_lock)(void);
+	void		(*write_unlock)(void);
+	bool		(*write_held)(void);
+	unsigned long	(*start_synchronize)(bool expedited);
+	void		(*cond_synchronize)(unsigned long cookie,
+				bool expedited);
+};
+
+static const struct sync_ops *sync_ops;
+
+static DEFINE_MUTEX(state_mutex);
+
+/*
+ * Mirrors server.state->is_in_recovery for the hot paths.
+ *
+ * Recovery is rare, so the normal mode check in the readers is patched to
+ * a NOP instead of a load of server.state. It is flipped by
+ * set_mode_recovery() only.
+ * */
+static DEFINE_STATIC_KEY_FALSE(recovery_mode);
+static DEFINE_PER_CPU(struct http_stats, http_stats);
+
+#define http_stats_inc(field) this_cpu_inc(http_stats.field)
+#define http_stats_add(field, val) this_cpu_add(http_stats.field, val)
+
+/*
+ * Accounts a read section which started at @start (local_clock()), taken
+ * before sync_ops->read_lock() and accounted after sync_ops->read_unlock()
+ * so that the cost of the backend primitives is part of it. */
+static inline void http_stats_read_section(u64 start) {
+	u64 delta = local_clock() - start;
+	int bucket = delta ? fls64(delta) - 1 : 0;
+
+	if(bucket >= LATENCY_BUCKETS) {
+		bucket = LATENCY_BUCKETS - 1;
+	}
+
+	this_cpu_inc(http_stats.read_latency[bucket]);
+}
+
+struct content_txn;
+
+/*
+ * Provided by the includer: versions are allocated, freed and rendered
+ * differently by each build. */
+static inline struct web_data *alloc_web_data(void);
+static inline void free_web_data_now(struct web_data *web_data);
+static inline int render_web_data(struct web_data *web_data,
+		const struct content_txn *txn);
+
+/*
+ * Frees a version replaced in or removed from server.content once
+ * readers are done with it, see content_reclaim_rcu().
+ *
+ * Lookups walk server.content under RCU whatever the backend and the
+ * serving path sends versions under http_srcu, hence every replaced
+ * version waits for both. */
+static void free_web_data_rcu(struct rcu_head *head) {
+	free_web_data_now(container_of(head, struct web_data, rcu));
+}
+
+static inline bool web_data_key_equal(const struct web_data_key *a,
+		const struct web_data_key *b) {
+	return a->len == b->len && !memcmp(a->path, b->path, a->len);
+}
+
+static const struct web_data_key root_key = {
+	.path = "/",
+	.len = 1,
+};
+
+static inline void set_web_data_path(struct web_data *web_data,
+		const char *path, unsigned int len) {
+	memcpy(web_data->path, path, len);
+	web_data->key.path = web_data->path;
+	web_data->key.len = len;
+}
+
+static inline u32 content_hash(const struct web_data_key *key) {
+	return jhash(key->path, key->len, 0);
+}
+
+static inline unsigned int content_dir_index(u32 hash) {
+	return hash & (CONTENT_FANOUT - 1);
+}
+
+static inline unsigned int content_leaf_index(u32 hash) {
+	return (hash >> CONTENT_FANOUT_SHIFT) & (CONTENT_FANOUT - 1);
+}
+
+static inline int content_leaf_find(const struct content_leaf *leaf,
+		const struct web_data_key *key) {
+	int i;
+
+	for(i = 0; leaf && i < leaf->nr; i++) {
+		if(web_data_key_equal(&leaf->entries[i]->key, key)) {
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+static inline bool content_leaf_has(const struct content_leaf *leaf,
+		const struct web_data *web_data) {
+	int i = content_leaf_find(leaf, &web_data->key);
+
+	return i >= 0 && leaf->entries[i] == web_data;
+}
+
+/*
+ * Looks up the resource at @key in the generation @content, the caller
+ * must be in an RCU read section. */
+static inline struct web_data *lookup_web_data(
+		const struct content_set *content,
+		const struct web_data_key *key) {
+	const struct content_leaf *leaf;
+	const struct content_dir *dir;
+	u32 hash = content_hash(key);
+	int i;
+
+	dir = content->dirs[content_dir_index(hash)];
+	if(dir == NULL) {
+		return NULL;
+	}
+
+	leaf = dir->leaves[content_leaf_index(hash)];
+	i = content_leaf_find(leaf, key);
+
+	return i < 0 ? NULL : leaf->entries[i];
+}
+
+/*
+ * "/" for readers, between sync_ops->read_lock() and
+ * sync_ops->read_unlock().
+ *
+ * The generation is walked under RCU whatever the backend, "/" itself is
+ * only replaced by the writers of the backend. */
+static inline struct web_data *read_web_data(void) {
+	struct web_data *web_data;
+
+	rcu_read_lock();
+	web_data = lookup_web_data(rcu_dereference(server.content),
+			&root_key);
+	rcu_read_unlock();
+
+	return web_data;
+}
+
+/*
+ * Transactions over server.content.
+ *
+ * A transaction stages any number of changes in a private copy of the
+ * current generation (content_txn_put(), content_txn_remove()), makes
+ * them all visible at once (content_txn_publish()) and retires what the
+ * new generation no longer uses (content_txn_finish()). Transactions are
+ * serialized by content_mutex, and may sleep while staging.
+ * */
+struct content_txn {
+	struct content_set *old;
+	struct content_set *new;
+};
+
+static DEFINE_MUTEX(content_mutex);
+
+/*
+ * Read sections of the serving path, which may sleep while sending the
+ * versions they picked. Replaced generations wait for an http_srcu grace
+ * period, then for an RCU one for the other readers.
+ * */
+DEFINE_STATIC_SRCU(http_srcu);
+
+/*
+ * Replaced versions waiting for a grace period to be reclaimed.
+ *
+ * Updaters can replace versions faster than grace periods elapse, above
+ * reclaim_backlog_max they back off until content_reclaim_rcu() catches
+ * up, so that memory use stays bounded under update storms.
+ * */
+static atomic_long_t content_backlog = ATOMIC_LONG_INIT(0);
+static DECLARE_WAIT_QUEUE_HEAD(content_backlog_wait);
+
+static inline bool content_backlog_full(void) {
+	unsigned int max = READ_ONCE(reclaim_backlog_max);
+
+	return max && atomic_long_read(&content_backlog) >= max;
+}
+
+static inline int content_txn_begin(struct content_txn *txn) {
+	mutex_lock(&content_mutex);
+
+	txn->old = rcu_dereference_protected(server.content,
+			lockdep_is_held(&content_mutex));
+	if(txn->old != NULL) {
+		txn->new = kmemdup(txn->old, sizeof(*txn->old), GFP_KERNEL);
+	} else {
+		txn->new = kzalloc(sizeof(*txn->new), GFP_KERNEL);
+	}
+
+	if(txn->new == NULL) {
+		mutex_unlock(&content_mutex);
+		return -ENOMEM;
+	}
+
+	txn->new->generation++;
+	txn->new->retired = NULL;
+	txn->new->nr_retired = 0;
+
+	return 0;
+}
+
+/*
+ * The resource at @key as staged in @txn. */
+static inline struct web_data *content_txn_get(struct content_txn *txn,
+		const struct web_data_key *key) {
+	return lookup_web_data(txn->new, key);
+}
+
+static inline struct content_dir *content_txn_old_dir(
+		struct content_txn *txn, unsigned int i) {
+	return txn->old ? txn->old->dirs[i] : NULL;
+}
+
+static inline struct content_leaf *content_txn_old_leaf(
+		struct content_txn *txn, unsigned int i, unsigned int j) {
+	struct content_dir *dir = content_txn_old_dir(txn, i);
+
+	return dir ? dir->leaves[j] : NULL;
+}
+
+/*
+ * Replaces the leaf of bucket (@i, @j) in the staged generation by a copy
+ * with room for @nr entries, copying the directory on the way unless
+ * this transaction did already.
+ * */
+static inline struct content_leaf *content_txn_cow(struct content_txn *txn,
+		unsigned int i, unsigned int j, unsigned int nr) {
+	struct content_dir *dir = txn->new->dirs[i];
+	struct content_leaf *leaf, *new_leaf;
+
+	if(dir == NULL || dir == content_txn_old_dir(txn, i)) {
+		dir = dir ? kmemdup(dir, sizeof(*dir), GFP_KERNEL) :
+				kzalloc(sizeof(*dir), GFP_KERNEL);
+		if(dir == NULL) {
+			return NULL;
+		}
+		txn->new->dirs[i] = dir;
+	}
+
+	leaf = dir->leaves[j];
+	new_leaf = kmalloc(struct_size(new_leaf, entries, nr), GFP_KERNEL);
+	if(new_leaf == NULL) {
+		return NULL;
+	}
+
+	new_leaf->nr = leaf ? min(leaf->nr, nr) : 0;
+	if(leaf != NULL) {
+		memcpy(new_leaf->entries, leaf->entries,
+				new_leaf->nr * sizeof(*leaf->entries));
+	}
+
+	/*
+	 * A leaf already copied by this transaction was never published. */
+	if(leaf != content_txn_old_leaf(txn, i, j)) {
+		kfree(leaf);
+	}
+	dir->leaves[j] = new_leaf;
+
+	return new_leaf;
+}
+
+/*
+ * Stages @web_data, adding its path or replacing the version staged for
+ * it. A replaced version which was staged by this transaction is freed.
+ * */
+static inline int content_txn_put(struct content_txn *txn,
+		struct web_data *web_data) {
+	struct content_leaf *leaf;
+	u32 hash = content_hash(&web_data->key);
+	unsigned int i = content_dir_index(hash);
+	unsigned int j = content_leaf_index(hash);
+	struct content_dir *dir = txn->new->dirs[i];
+	int k;
+
+	leaf = dir ? dir->leaves[j] : NULL;
+	k = content_leaf_find(leaf, &web_data->key);
+
+	leaf = content_txn_cow(txn, i, j, (leaf ? leaf->nr : 0) + (k < 0));
+	if(leaf == NULL) {
+		return -ENOMEM;
+	}
+
+	if(k < 0) {
+		leaf->entries[leaf->nr++] = web_data;
+		return 0;
+	}
+
+	if(!content_leaf_has(content_txn_old_leaf(txn, i, j),
+			leaf->entries[k])) {
+		free_web_data_now(leaf->entries[k]);
+	}
+	leaf->entries[k] = web_data;
+
+	return 0;
+}
+
+/*
+ * Stages the removal of the resource at @key. */
+static inline int content_txn_remove(struct content_txn *txn,
+		const struct web_data_key *key) {
+	struct content_leaf *leaf;
+	u32 hash = content_hash(key);
+	unsigned int i = content_dir_index(hash);
+	unsigned int j = content_leaf_index(hash);
+	struct content_dir *dir = txn->new->dirs[i];
+	struct web_data *web_data;
+	int k;
+
+	leaf = dir ? dir->leaves[j] : NULL;
+	k = content_leaf_find(leaf, key);
+	if(k < 0) {
+		return -ENOENT;
+	}
+
+	web_data = leaf->entries[k];
+	leaf = content_txn_cow(txn, i, j, leaf->nr);
+	if(leaf == NULL) {
+		return -ENOMEM;
+	}
+
+	leaf->entries[k] = leaf->entries[--leaf->nr];
+	if(!content_leaf_has(content_txn_old_leaf(txn, i, j), web_data)) {
+		free_web_data_now(web_data);
+	}
+
+	return 0;
+}
+
+static void content_leaf_free_rcu(struct rcu_head *head) {
+	kfree(container_of(head, struct content_leaf, rcu));
+}
+
+static void content_dir_free_rcu(struct rcu_head *head) {
+	kfree(container_of(head, struct content_dir, rcu));
+}
+
+/*
+ * Retired objects are chained through the link of their rcu_head, which
+ * liburcu lays out as a queue node.
+ * */
+#ifdef __KERNEL__
+static inline struct rcu_head *rcu_head_next(struct rcu_head *head) {
+	return head->next;
+}
+
+static inline void rcu_head_set_next(struct rcu_head *head,
+		struct rcu_head *next) {
+	head->next = next;
+}
+#else
+static inline struct rcu_head *rcu_head_next(struct rcu_head *head) {
+	return head->next.next ?
+		caa_container_of(head->next.next, struct rcu_head, next) :
+		NULL;
+}
+
+static inline void rcu_head_set_next(struct rcu_head *head,
+		struct rcu_head *next) {
+	head->next.next = next ? &next->next : NULL;
+}
+#endif
+
+/*
+ * Reclaims a replaced generation along with everything only it used, a
+ * single callback however many objects its transaction retired.
+ * */
+static void content_reclaim_rcu(struct rcu_head *head) {
+	struct content_set *content = container_of(head, struct content_set,
+			rcu);
+	struct rcu_head *obj, *next;
+
+	for(obj = content->retired; obj != NULL; obj = next) {
+		next = rcu_head_next(obj);
+		obj->func(obj);
+	}
+
+	atomic_long_sub(content->nr_retired, &content_backlog);
+	if(!content_backlog_full()) {
+		wake_up_all(&content_backlog_wait);
+	}
+
+	kfree(content);
+}
+
+/*
+ * The serving path is done with the generation, wait for the RCU readers.
+ * */
+static void content_reclaim_srcu(struct rcu_head *head) {
+	call_rcu(head, content_reclaim_rcu);
+}
+
+static inline void content_retire(struct content_set *content,
+		struct rcu_head *head, rcu_callback_t reclaim) {
+	head->func = reclaim;
+	rcu_head_set_next(head, content->retired);
+	content->retired = head;
+}
+
+/*
+ * Frees the nodes and versions of the generation @from which @to does
+ * not use. Called with @from the new generation to abort a transaction
+ * (nothing was published), with @from the old one after publishing
+ * (readers may still walk it, everything is chained to @from and waits
+ * for one http_srcu and one RCU grace period).
+ * */
+static inline void content_release_diff(struct content_set *from,
+		struct content_set *to, bool published) {
+	struct content_leaf *leaf, *to_leaf;
+	struct content_dir *dir, *to_dir;
+	int i, j, k;
+
+	for(i = 0; from && i < CONTENT_FANOUT; i++) {
+		dir = from->dirs[i];
+		to_dir = to ? to->dirs[i] : NULL;
+		if(dir == NULL || dir == to_dir) {
+			continue;
+		}
+
+		for(j = 0; j < CONTENT_FANOUT; j++) {
+			leaf = dir->leaves[j];
+			to_leaf = to_dir ? to_dir->leaves[j] : NULL;
+			if(leaf == NULL || leaf == to_leaf) {
+				continue;
+			}
+
+			for(k = 0; k < leaf->nr; k++) {
+				if(content_leaf_has(to_leaf, leaf->entries[k])) {
+					continue;
+				}
+
+				if(published) {
+					content_retire(from,
+						&leaf->entries[k]->rcu,
+						free_web_data_rcu);
+					from->nr_retired++;
+				} else {
+					free_web_data_now(leaf->entries[k]);
+				}
+			}
+
+			if(published) {
+				content_retire(from, &leaf->rcu,
+						content_leaf_free_rcu);
+			} else {
+				kfree(leaf);
+			}
+		}
+
+		if(published) {
+			content_retire(from, &dir->rcu, content_dir_free_rcu);
+		} else {
+			kfree(dir);
+		}
+	}
+
+	if(from == NULL) {
+		return;
+	}
+
+	if(published) {
+		atomic_long_add(from->nr_retired, &content_backlog);
+		call_srcu(&http_srcu, &from->rcu, content_reclaim_srcu);
+	} else {
+		kfree(from);
+	}
+}
+
+static inline void content_txn_abort(struct content_txn *txn) {
+	content_release_diff(txn->new, txn->old, false);
+	mutex_unlock(&content_mutex);
+}
+
+/*
+ * Makes every change of @txn visible at once, may be called under
+ * sync_ops->write_lock().
+ * */
+static inline void content_txn_publish(struct content_txn *txn) {
+	rcu_assign_pointer(server.content, txn->new);
+}
+
+static inline void content_txn_finish(struct content_txn *txn) {
+	content_release_diff(txn->old, txn->new, true);
+	mutex_unlock(&content_mutex);
+}
+
+/*
+ * This probably means we are in recovery, hence "/" may be in an
+ * inconsistent state hence cannot dereference the data. */
+static inline void send_data_carefully(int id) {
+	http_stats_inc(recovery_responses);
+	trace_recovery_response(id);
+}
+
+/*
+ * Conditions are normal, and we are being executed in a read section
+ * we can dereference the data and send it. */
+static inline void send_data(int id) {
+	struct web_data *web_data = read_web_data();
+
+	http_stats_inc(normal_responses);
+	trace_response_sent(id, 200, web_data->message);
+}
+
+/*
+ * Read section of a client, shared with the benchmark readers. */
+static inline void client_read(int id) {
+	struct sync_read_ctx ctx;
+	bool retry;
+	u64 start;
+
+	do {
+		start = local_clock();
+		sync_ops->read_lock(&ctx);
+		if(static_branch_unlikely(&recovery_mode)) {
+			send_data_carefully(id);
+		} else {
+			send_data(id);
+		}
+		retry = sync_ops->read_unlock(&ctx);
+		http_stats_read_section(start);
+	} while(retry);
+}
+
+/*
+ * Switches the server in or out of recovery mode.
+ *
+ * Patching the static key may sleep, hence state_mutex is a mutex. Readers
+ * which already passed the check keep running in the old mode until the
+ * end of their read section, callers which need all readers to observe
+ * the new mode must wait for a grace period.
+ * */
+static inline void set_mode_recovery(bool flag) {
+	struct state *current_state;
+
+	mutex_lock(&state_mutex);
+	current_state = rcu_dereference_protected(server.state,
+			lockdep_is_held(&state_mutex));
+
+	if(current_state->is_in_recovery == flag) {
+		mutex_unlock(&state_mutex);
+		return;
+	}
+
+	current_state->is_in_recovery = flag;
+
+	if(flag) {
+		static_branch_enable(&recovery_mode);
+	} else {
+		static_branch_disable(&recovery_mode);
+	}
+
+	mutex_unlock(&state_mutex);
+}
+
+/*
+ * Builds the repaired version of "/" off to the side.
+ *
+ * No lock is held and the server is not in recovery mode while doing so,
+ * readers keep being served the last good version and the updater keeps
+ * running. The result is published by recover_server().
+ *
+ * @snapshot - set to the message the repair was computed from
+ * */
+static inline struct web_data *build_recovered_data(int *snapshot) {
+	struct web_data *new_web_data;
+	struct sync_read_ctx ctx;
+
+	new_web_data = alloc_web_data();
+
+	if(new_web_data == NULL) {
+		return NULL;
+	}
+
+	do {
+		sync_ops->read_lock(&ctx);
+		*snapshot = read_web_data()->message;
+	} while(sync_ops->read_unlock(&ctx));
+
+	/*
+	 * This is a simple example, but sadly recovering a failed system
+	 * doesn't take a few nanoseconds.
+	 * */
+	msleep_interruptible(READ_ONCE(time_to_recover)*1000);
+
+	new_web_data->message = (2*(*snapshot));
+
+	return new_web_data;
+}
+
+/*
+ * The grace period of a recovery, expedited if recovery_expedited was set
+ * when it started. start and end are local_clock() when it was started
+ * and when recovery could publish.
+ * */
+struct recovery_gp {
+	unsigned long cookie;
+	bool expedited;
+	u64 start;
+	u64 end;
+};
+
+static inline void recovery_gp_start(struct recovery_gp *gp) {
+	gp->expedited = READ_ONCE(recovery_expedited);
+	gp->start = local_clock();
+	gp->cookie = sync_ops->start_synchronize(gp->expedited);
+}
+
+static inline void recovery_gp_wait(struct recovery_gp *gp) {
+	sync_ops->cond_synchronize(gp->cookie, gp->expedited);
+	gp->end = local_clock();
+}
+
+/*
+ * Publishes the copy built by build_recovered_data() as the next
+ * generation of server.content, once the grace period @gp has elapsed.
+ *
+ * The generation is staged and rendered while the grace period runs,
+ * only the wait for its end remains when there is nothing left to
+ * prepare. Only the generation swap and the timestamp update happen under
+ * the write lock, nothing in there sleeps.
+ *
+ * Returns -ENOMEM if the generation could not be staged, @new_web_data
+ * is freed either way.
+ * */
+static inline int recover_server(struct web_data *new_web_data,
+		int snapshot, struct recovery_gp *gp) {
+	struct web_data *web_data;
+	struct time *update_timestamp;
+	struct content_txn txn;
+	int err;
+
+	err = content_txn_begin(&txn);
+	if(err) {
+		free_web_data_now(new_web_data);
+		return err;
+	}
+
+	/*
+	 * The updater may have published while the copy was being built,
+	 * in that case rebase the repair onto the current version. Updates
+	 * are serialized with this transaction, "/" cannot change anymore.
+	 *
+	 * The copy is rendered only now, as the version of this generation.
+	 * */
+	web_data = content_txn_get(&txn, &root_key);
+	if(web_data->message != snapshot) {
+		new_web_data->message = (2*(web_data->message));
+	}
+	set_web_data_path(new_web_data, root_key.path, root_key.len);
+	err = render_web_data(new_web_data, &txn);
+	if(!err) {
+		err = content_txn_put(&txn, new_web_data);
+	}
+	if(err) {
+		free_web_data_now(new_web_data);
+		content_txn_abort(&txn);
+		return err;
+	}
+
+	recovery_gp_wait(gp);
+
+	sync_ops->write_lock();
+	content_txn_publish(&txn);
+
+	/*
+	 * Note: we cannot modify web_data in place, e.g.
+	 * web_data->message = (1<<web_data->message);
+	 * since below we need to use web_data->message to update the
+	 * timestamp, and readers may still be using the old version.
+	 *
+	 * The old version stays untouched until it is retired.
+	 * */
+	update_timestamp = rcu_dereference_protected(server.update_timestamp,
+			sync_ops->write_held());
+	update_timestamp->time = web_data->message ^ update_timestamp->time;
+
+	sync_ops->write_unlock();
+
+	content_txn_finish(&txn);
+	http_stats_inc(recoveries);
+
+	return 0;
+}
+
+/*
+ * A failure of the server and its recovery, run by the recovery thread.
+ *
+ * The recovery of the system takes a lot of time to complete. Rather than
+ * repairing "/" in place, which would leave it inconsistent
+ * for the whole duration, the repaired version is built as a shadow copy
+ * (build_recovered_data()) while readers keep getting 200 responses from
+ * the last good version.
+ *
+ * Only once the copy is ready the state is set to recovery, so that
+ * readers stop using the outgoing version (send_data_carefully()) and the
+ * updater stops publishing, and the copy is published with a single
+ * rcu_assign_pointer(). The 438 window is hence one grace period long
+ * instead of time_to_recover seconds, and the grace period is polled so
+ * that the generation is staged while it elapses rather than after it.
+ *
+ * The grace period waited on is started by sync_ops->start_synchronize()
+ * right after the switch to recovery, and recover_server() waits for it
+ * with sync_ops->cond_synchronize() once the generation is staged. With
+ * RCU it is a normal or expedited polled grace period, the non RCU
+ * backends cannot poll and drain their readers in cond_synchronize().
+ * */
+static inline void recover_system(void) {
+	struct web_data *new_web_data;
+	struct recovery_gp gp = { };
+	u64 window_start;
+	int snapshot, err;
+
+	printk(KERN_INFO "HTTP-SERVER: [FATAL] Some error occured. Initializing recovery procedure.\n");
+
+	new_web_data = build_recovered_data(&snapshot);
+	if(new_web_data == NULL) {
+		printk(KERN_ERR "HTTP-SERVER: Not enough memory to recover\n");
+		return;
+	}
+
+	window_start = local_clock();
+	set_mode_recovery(true);
+
+	/*
+	 * This grace period is important before publishing the
+	 * repaired data.
+	 *
+	 * It instructs all the on going reader sections to exit.
+	 *
+	 * Once it has elapsed, all the readers will see the updated
+	 * state (recovery) and none of them would use the outgoing
+	 * version. The updater checks the state under the write lock
+	 * and stops publishing.
+	 *
+	 * It is only started here, recover_server() waits for it
+	 * right before publishing.
+	 *
+	 * See client_read()
+	 * */
+	recovery_gp_start(&gp);
+
+	printk(KERN_INFO "HTTP-SERVER: Starting server secovery\n");
+
+	/*
+	 * Swap in the repaired data.
+	 * */
+	err = recover_server(new_web_data, snapshot, &gp);
+	if(err) {
+		printk(KERN_ERR "HTTP-SERVER: Not enough memory to recover\n");
+	} else {
+		printk(KERN_INFO "HTTP-SERVER: Server successfully recovered\n");
+	}
+
+	/*
+	 * Recovery is done. Readers can now access "/" again.
+	 * */
+	set_mode_recovery(false);
+
+	if(!err) {
+		http_stats_inc(recovery_gps[gp.expedited]);
+		http_stats_add(recovery_gp_ns[gp.expedited],
+				gp.end - gp.start);
+		http_stats_add(recovery_window_ns[gp.expedited],
+				local_clock() - window_start);
+	}
+}
+
+/*
+ * Applies @nr updates to "/" in a single version, published as the next
+ * generation of server.content, shared with the benchmark updaters.
+ *
+ * However many updates are batched, there is one generation to publish
+ * and one to reclaim, with a single RCU callback. The version is staged
+ * before taking the write lock, which only covers the recovery check and
+ * the generation swap.
+ *
+ * Returns -EAGAIN when the server is in recovery mode and -ENOMEM if no
+ * web_data could be allocated.
+ * */
+static inline int publish_updates(unsigned int nr) {
+	struct web_data *web_data;
+	struct web_data *new_web_data;
+	struct content_txn txn;
+	int err;
+
+	err = content_txn_begin(&txn);
+	if(err) {
+		http_stats_inc(alloc_failures);
+		return err;
+	}
+
+	web_data = content_txn_get(&txn, &root_key);
+
+	new_web_data = alloc_web_data();
+
+	if(new_web_data == NULL) {
+		content_txn_abort(&txn);
+		http_stats_inc(alloc_failures);
+		return -ENOMEM;
+	}
+
+	set_web_data_path(new_web_data, root_key.path, root_key.len);
+	new_web_data->message = (web_data->message)+3*nr;
+	err = render_web_data(new_web_data, &txn);
+	if(!err) {
+		err = content_txn_put(&txn, new_web_data);
+	}
+	if(err) {
+		free_web_data_now(new_web_data);
+		content_txn_abort(&txn);
+		http_stats_inc(alloc_failures);
+		return err;
+	}
+
+	sync_ops->write_lock();
+	if(static_branch_unlikely(&recovery_mode)) {
+		sync_ops->write_unlock();
+		content_txn_abort(&txn);
+		return -EAGAIN;
+	}
+
+	content_txn_publish(&txn);
+	sync_ops->write_unlock();
+
+	http_stats_add(updates, nr);
+	trace_web_data_updated(web_data->message, new_web_data->message);
+	content_txn_finish(&txn);
+
+	return 0;
+}
+
+/*
+ * One period of the updater thread, update_batch more updates.
+ *
+ * While the reclamation backlog is full, updates are coalesced instead of
+ * published, and published all at once in the next version. Updates
+ * which could not be published, during a recovery or for lack of memory,
+ * are kept pending the same way.
+ *
+ * @pending - updates not published yet, carried between periods
+ * */
+static inline void updater_step(unsigned int *pending) {
+	unsigned int nr = min(READ_ONCE(update_batch), UPDATE_BATCH_MAX);
+
+	*pending += nr;
+
+	if(content_backlog_full()) {
+		http_stats_add(coalesced_updates, nr);
+	} else if(!publish_updates(*pending)) {
+		*pending = 0;
+	}
+}
+
+/*
+ * One publication of a benchmark updater, returns the number of updates
+ * published.
+ *
+ * Back to back updates outrun grace periods, wait for the reclamation to
+ * catch up rather than coalescing.
+ * */
+static inline unsigned int bench_updater_step(void) {
+	unsigned int nr;
+
+	if(content_backlog_full()) {
+		http_stats_inc(backlog_waits);
+		wait_event_interruptible(content_backlog_wait,
+				!content_backlog_full());
+	}
+
+	nr = min(READ_ONCE(update_batch), UPDATE_BATCH_MAX);
+
+	return publish_updates(nr) ? 0 : nr;
+}
+
+static inline int initialize_time(void) {
+	struct time *time;
+
+	time = kmalloc(sizeof(*time), GFP_KERNEL);
+
+	if(time == NULL) {
+		return -ENOMEM;
+	}
+
+	time->time = 0;
+
+	rcu_assign_pointer(server.update_timestamp, time);
+
+	return 0;
+}
+
+static inline int initialize_state(void) {
+	struct state *state;
+
+	state = kmalloc(sizeof(*state), GFP_KERNEL);
+
+	if(state == NULL) {
+		return -ENOMEM;
+	}
+
+	state->is_in_recovery = false;
+	rcu_head_init(&state->rcu);
+
+	rcu_assign_pointer(server.state, state);
+
+	return 0;
+}
+
+/*
+ * Publishes the first generation of server.content, holding "/" only.
+ * */
+static inline int initialize_web_data(void) {
+	struct web_data *web_data;
+	struct content_txn txn;
+	int err;
+
+	err = content_txn_begin(&txn);
+	if(err) {
+		return err;
+	}
+
+	web_data = alloc_web_data();
+
+	if(web_data == NULL) {
+		content_txn_abort(&txn);
+		return -ENOMEM;
+	}
+
+	set_web_data_path(web_data, root_key.path, root_key.len);
+	web_data->message = 0;
+	err = render_web_data(web_data, &txn);
+	if(!err) {
+		err = content_txn_put(&txn, web_data);
+	}
+	if(err) {
+		free_web_data_now(web_data);
+		content_txn_abort(&txn);
+		return err;
+	}
+
+	content_txn_publish(&txn);
+	content_txn_finish(&txn);
+
+	return 0;
+}
+
+/*
+ * Retires the last generation of server.content and waits until it and
+ * all the generations before it are reclaimed. Must be called once no
+ * thread uses server.content anymore.
+ * */
+static inline void clean_up_content(void) {
+	content_release_diff(rcu_replace_pointer(server.content, NULL, true),
+			NULL, true);
+
+	/*
+	 * Wait for the generations still queued by content_txn_finish(),
+	 * through http_srcu first.
+	 * */
+	srcu_barrier(&http_srcu);
+
+	/*
+	 * Then through RCU.
+	 * */
+	rcu_barrier();
+}
+
+#endif
@@ -5,6 +5,39 @@
 #include <linux/slab.h>
 #include <linux/kthread.h>
 #include <linux/delay.h>
+#include <linux/net.h>
+#include <linux/in.h>
+#include <linux/socket.h>
+#include <net/sock.h>
+#include <linux/percpu.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/sched/clock.h>
+#include <linux/jump_label.h>
+#include <linux/mutex.h>
+#include <linux/workqueue.h>
+#include <linux/moduleparam.h>
+#include <linux/cpumask.h>
+#include <linux/rwlock.h>
+#include <linux/seqlock.h>
+#include <linux/percpu-rwsem.h>
+#include <linux/mm.h>
+#include <linux/bvec.h>
+#include <linux/uio.h>
+#include <linux/jhash.h>
+#include <linux/sort.h>
+#include <linux/random.h>
+#include <linux/time.h>
+#include <linux/timekeeping.h>
+#include <linux/vmalloc.h>
+#include <linux/zlib.h>
+#include <linux/crc32.h>
+#include <linux/srcu.h>
+
+#define CREATE_TRACE_POINTS
+#include "http_server_rcu_trace.h"
+
+#include "http_parser.h"
 
 #define RECOVERY_SLEEP_TIME 30
 #define TIME_TO_RECOVER 25
@@ -12,321 +45,2962 @@
 #define NUM_CLIENTS 3
 #define TIMEOUT_MULTIPLIER 5
 #define UPDATE_FREQUENCY 20
+#define LISTEN_BACKLOG 128
+#define SOCKET_TIMEOUT 1
+#define KEEPALIVE_TIMEOUT 5
+#define HTTP_CONN_BUDGET 8
+#define REQUEST_BUFFER_SIZE 2048
+#define HTTP_BATCH_MAX 16
+#define HTTP_BODY_MAX 1536
+#define HTTP_ETAG_MAX 40
+#define HTTP_COMPRESS_MIN 256
+#define HTTP_ROUTES_MAX 256
+#define HTTP_ROUTES_SIZE 16384
+#define HTTP_PUBLISH_SIZE 65536
+#define WEB_DATA_POOL_SIZE 8
+
+static ushort port = 8080;
+module_param(port, ushort, 0444);
+MODULE_PARM_DESC(port, "TCP port the HTTP listener binds to (default: 8080)");
+
+static bool listen_any;
+module_param(listen_any, bool, 0444);
+MODULE_PARM_DESC(listen_any, "Listen on all addresses instead of loopback only");
 
-struct state {
-	bool is_in_recovery;
-	struct rcu_head rcu;
+/*
+ * Parameters which zero would turn into a busy loop or a thread doing
+ * nothing: the intervals and update_batch.
+ * */
+static int param_set_positive_uint(const char *val,
+		const struct kernel_param *kp) {
+	return param_set_uint_minmax(val, kp, 1, UINT_MAX);
+}
+
+static const struct kernel_param_ops positive_uint_ops = {
+	.set = param_set_positive_uint,
+	.get = param_get_uint,
 };
 
-struct time {
-	int time;
+/*
+ * Intervals in seconds, read on every iteration of the threads using them
+ * hence writable at runtime.
+ * */
+
+static unsigned int update_frequency = UPDATE_FREQUENCY;
+module_param_cb(update_frequency, &positive_uint_ops, &update_frequency, 0644);
+MODULE_PARM_DESC(update_frequency, "Seconds between two updates of web_data");
+
+static unsigned int time_before_recovery = TIME_BEFORE_RECOVERY;
+module_param_cb(time_before_recovery, &positive_uint_ops, &time_before_recovery, 0644);
+MODULE_PARM_DESC(time_before_recovery, "Seconds before the simulated failure");
+
+static unsigned int time_to_recover = TIME_TO_RECOVER;
+module_param_cb(time_to_recover, &positive_uint_ops, &time_to_recover, 0644);
+MODULE_PARM_DESC(time_to_recover, "Seconds the repair of web_data takes");
+
+/*
+ * Updates applied to "/" per published generation, read on every
+ * publication and capped to UPDATE_BATCH_MAX there. */
+static unsigned int update_batch = 1;
+module_param_cb(update_batch, &positive_uint_ops, &update_batch, 0644);
+MODULE_PARM_DESC(update_batch, "Updates of web_data applied per published version, at most 1024 (default: 1)");
+
+/*
+ * Read on every publication of the updaters. */
+static unsigned int reclaim_backlog_max = 1024;
+module_param(reclaim_backlog_max, uint, 0644);
+MODULE_PARM_DESC(reclaim_backlog_max, "Replaced versions waiting for a grace period above which updaters back off, 0 for no limit (default: 1024)");
+
+/*
+ * Read at every recovery. */
+static bool recovery_expedited;
+module_param(recovery_expedited, bool, 0644);
+MODULE_PARM_DESC(recovery_expedited, "Wait for the recovery grace period with expedited RCU, shorter but IPIs every CPU");
+
+/*
+ * Thread counts and the client timeouts derived from timeout_multiplier
+ * are only used when the threads are created.
+ * */
+static unsigned int num_clients = NUM_CLIENTS;
+module_param(num_clients, uint, 0444);
+MODULE_PARM_DESC(num_clients, "Number of simulated client threads");
+
+static unsigned int timeout_multiplier = TIMEOUT_MULTIPLIER;
+module_param_cb(timeout_multiplier, &positive_uint_ops, &timeout_multiplier, 0444);
+MODULE_PARM_DESC(timeout_multiplier, "Client i sleeps i*timeout_multiplier seconds between reads");
+
+/*
+ * CPU placement, cpulist format ("0-3,8"). Empty means no restriction.
+ * */
+static struct cpumask client_cpus;
+static struct cpumask updater_cpus;
+static struct cpumask worker_cpus;
+
+static int param_set_cpus(const char *val, const struct kernel_param *kp) {
+	cpumask_var_t mask;
+	int err;
+
+	if(!alloc_cpumask_var(&mask, GFP_KERNEL)) {
+		return -ENOMEM;
+	}
+
+	err = cpulist_parse(strim((char *)val), mask);
+	if(!err && !cpumask_empty(mask) &&
+			!cpumask_intersects(mask, cpu_online_mask)) {
+		err = -EINVAL;
+	}
+
+	if(!err) {
+		cpumask_copy(kp->arg, mask);
+	}
+
+	free_cpumask_var(mask);
+	return err;
+}
+
+static int param_get_cpus(char *buf, const struct kernel_param *kp) {
+	return sprintf(buf, "%*pbl\n", cpumask_pr_args((struct cpumask *)kp->arg));
+}
+
+static const struct kernel_param_ops cpus_ops = {
+	.set = param_set_cpus,
+	.get = param_get_cpus,
 };
 
+module_param_cb(client_cpus, &cpus_ops, &client_cpus, 0444);
+MODULE_PARM_DESC(client_cpus, "CPUs the client threads are bound to (cpulist)");
+
+module_param_cb(updater_cpus, &cpus_ops, &updater_cpus, 0444);
+MODULE_PARM_DESC(updater_cpus, "CPUs the updater thread is bound to (cpulist)");
+
+module_param_cb(worker_cpus, &cpus_ops, &worker_cpus, 0444);
+MODULE_PARM_DESC(worker_cpus, "CPUs running a listener and an HTTP worker (cpulist, default: all online)");
+
+static char *sync_backend = "rcu";
+module_param_named(sync, sync_backend, charp, 0444);
+MODULE_PARM_DESC(sync, "Synchronization of web_data: rcu, rwlock, seqlock or percpu_rwsem (default: rcu)");
+
+/*
+ * Benchmark mode, see bench_thread().
+ * */
+static unsigned int bench_duration;
+module_param(bench_duration, uint, 0444);
+MODULE_PARM_DESC(bench_duration, "Run the benchmark for this many seconds instead of the simulation (default: 0, off)");
+
+static unsigned int bench_readers;
+module_param(bench_readers, uint, 0444);
+MODULE_PARM_DESC(bench_readers, "Benchmark reader threads (default: 0, one per online CPU)");
+
+static unsigned int bench_updaters = 1;
+module_param(bench_updaters, uint, 0444);
+MODULE_PARM_DESC(bench_updaters, "Benchmark updater threads (default: 1)");
+
 struct client {
 	int id;
 	struct task_struct	*task;
+	void			*data;
 	struct list_head	clients_list;
 };
 
-struct web_data {
-	int message;
-	struct rcu_head rcu;
+/*
+ * Per worker context.
+ *
+ * There is one worker per CPU, bound to it and accepting on its own
+ * listener. Accepted connections are served by work items on the same
+ * CPU. */
+struct http_worker {
+	int id;
+	struct socket *listener;
+};
+
+/*
+ * A complete HTTP response rendered in a page, once for each connection
+ * disposition, the variant for disposition i being len[i] bytes at
+ * off[i]. Several responses may share a page.
+ *
+ * Sockets transmit the page without copying and take their own page
+ * references, hence it may outlive its owner until the data left the
+ * machine.
+ * */
+enum http_disposition {
+	HTTP_KEEP_ALIVE,
+	HTTP_CLOSE,
+	NR_HTTP_DISPOSITIONS,
+};
+
+struct http_response {
+	struct page *page;
+	unsigned int off[NR_HTTP_DISPOSITIONS];
+	int len[NR_HTTP_DISPOSITIONS];
+};
+
+/*
+ * Content codings a version may be precomputed in, by order of preference,
+ * identity being the uncompressed body.
+ * */
+enum http_coding {
+	HTTP_CODING_GZIP,
+	HTTP_CODING_DEFLATE,
+	HTTP_CODING_IDENTITY,
+	NR_HTTP_CODINGS,
+};
+
+static const char * const http_coding_names[] = {
+	[HTTP_CODING_GZIP] = "gzip",
+	[HTTP_CODING_DEFLATE] = "deflate",
+	[HTTP_CODING_IDENTITY] = "identity",
 };
 
+/*
+ * A representation of a version in one content coding: its 200 response
+ * and not_modified, the 304 answering a conditional request for it, both
+ * rendered in the same page, and its entity tag.
+ *
+ * Representations in different codings are different entities, each has
+ * its own strong etag.
+ * */
+struct http_representation {
+	char etag[HTTP_ETAG_MAX];
+	unsigned int etag_len;
+	struct http_response response;
+	struct http_response not_modified;
+};
+
+/*
+ * What a version of a resource is served as: its representations in each
+ * content coding, rendered once when the version is built
+ * (render_resource()), and modified, the time it was built, which is the
+ * validator of its responses along with the etags of its representations.
+ *
+ * The identity representation always exists. The compressed ones are in
+ * their own page, which is NULL when compression would not make the body
+ * smaller. They are compressed once per version, so that the cost of
+ * compression follows the update rate, not the request rate.
+ * */
+struct web_data_render {
+	time64_t modified;
+	struct http_representation repr[NR_HTTP_CODINGS];
+};
+
+struct http_router;
+
 struct server {
 	struct list_head		clients;
-	struct web_data		__rcu	*web_data;
+	struct content_set	__rcu	*content;
+	struct http_router	__rcu	*router;
 	struct state		__rcu	*state;
 	struct time		__rcu	*update_timestamp;
 };
 
-static struct server server;
-static DEFINE_SPINLOCK(server_mutex);
-static DEFINE_SPINLOCK(state_mutex);
+static struct server server;
+static DEFINE_SPINLOCK(server_mutex);
+static struct dentry *debugfs_dir;
+
+/*
+ * The model shared with the userspace build, which needs struct
+ * web_data_render and struct server.
+ * */
+#include "http_server_model.h"
+
+/*
+ * Reserve of preallocated struct web_data, one per CPU.
+ *
+ * Publishing a new version takes an object from the local reserve, which
+ * never sleeps nor fails as long as the reserve isn't drained, and the
+ * reserve is topped up from process context by web_data_refill_work.
+ * Versions freed after a grace period go back to the local reserve first.
+ *
+ * The lock is only contended by the refill work, it is taken with
+ * interrupts disabled since RCU callbacks return objects to the reserve.
+ * */
+struct web_data_pool {
+	spinlock_t		lock;
+	int			nr;
+	struct web_data		*objs[WEB_DATA_POOL_SIZE];
+};
+
+static struct kmem_cache *web_data_cache;
+static DEFINE_PER_CPU(struct web_data_pool, web_data_pool);
+
+/*
+ * The page of the identity representation, kept when recycling the
+ * struct web_data. */
+static inline struct page *web_data_page(struct web_data *web_data) {
+	return web_data->render.repr[HTTP_CODING_IDENTITY].response.page;
+}
+
+/*
+ * Allocates a struct web_data along with its identity page, the pages of
+ * the coded representations are only allocated when rendering. */
+static inline struct web_data *new_web_data(gfp_t gfp) {
+	struct http_representation *identity;
+	struct web_data *web_data;
+	int i;
+
+	web_data = kmem_cache_alloc(web_data_cache, gfp);
+	if(web_data == NULL) {
+		return NULL;
+	}
+
+	for(i = 0; i < HTTP_CODING_IDENTITY; i++) {
+		web_data->render.repr[i].response.page = NULL;
+		web_data->render.repr[i].not_modified.page = NULL;
+	}
+
+	identity = &web_data->render.repr[HTTP_CODING_IDENTITY];
+	identity->response.page = alloc_page(gfp);
+	if(identity->response.page == NULL) {
+		kmem_cache_free(web_data_cache, web_data);
+		return NULL;
+	}
+	identity->not_modified.page = identity->response.page;
+
+	return web_data;
+}
+
+/*
+ * Drops the references of @web_data on its coded representations, which
+ * are specific to the version, unlike the identity page. */
+static inline void put_coded_pages(struct web_data *web_data) {
+	int i;
+
+	for(i = 0; i < HTTP_CODING_IDENTITY; i++) {
+		if(web_data->render.repr[i].response.page != NULL) {
+			put_page(web_data->render.repr[i].response.page);
+			web_data->render.repr[i].response.page = NULL;
+			web_data->render.repr[i].not_modified.page = NULL;
+		}
+	}
+}
+
+/*
+ * Drops the references of @web_data on its pages, a page is released
+ * once no socket buffer references it anymore. */
+static inline void destroy_web_data(struct web_data *web_data) {
+	put_coded_pages(web_data);
+	put_page(web_data_page(web_data));
+	kmem_cache_free(web_data_cache, web_data);
+}
+
+static void refill_web_data_pools(struct work_struct *work);
+static DECLARE_WORK(web_data_refill_work, refill_web_data_pools);
+
+/*
+ * Puts @web_data in the reserve of @pool, returns false if it is full. */
+static inline bool web_data_pool_put(struct web_data_pool *pool,
+		struct web_data *web_data) {
+	unsigned long flags;
+	bool ret = false;
+
+	spin_lock_irqsave(&pool->lock, flags);
+	if(pool->nr < WEB_DATA_POOL_SIZE) {
+		pool->objs[pool->nr++] = web_data;
+		ret = true;
+	}
+	spin_unlock_irqrestore(&pool->lock, flags);
+
+	return ret;
+}
+
+static void refill_web_data_pools(struct work_struct *work) {
+	struct web_data_pool *pool;
+	struct web_data *web_data;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		pool = per_cpu_ptr(&web_data_pool, cpu);
+
+		while(READ_ONCE(pool->nr) < WEB_DATA_POOL_SIZE) {
+			web_data = new_web_data(GFP_KERNEL);
+			if(web_data == NULL) {
+				return;
+			}
+
+			if(!web_data_pool_put(pool, web_data)) {
+				destroy_web_data(web_data);
+				break;
+			}
+		}
+	}
+}
+
+/*
+ * Allocates a struct web_data for a new version.
+ *
+ * Versions are built in process context, in a transaction under
+ * content_mutex or before starting one, never under a spinlock, hence this
+ * may sleep when the reserve is drained.
+ * */
+static inline struct web_data *alloc_web_data(void) {
+	struct web_data_pool *pool;
+	struct web_data *web_data = NULL;
+	unsigned long flags;
+	bool low;
+
+	might_sleep();
+
+	pool = get_cpu_ptr(&web_data_pool);
+	spin_lock_irqsave(&pool->lock, flags);
+	if(pool->nr > 0) {
+		web_data = pool->objs[--pool->nr];
+	}
+	low = pool->nr < WEB_DATA_POOL_SIZE/2;
+	spin_unlock_irqrestore(&pool->lock, flags);
+	put_cpu_ptr(&web_data_pool);
+
+	if(low) {
+		schedule_work(&web_data_refill_work);
+	}
+
+	/*
+	 * The reserve was drained faster than it could be refilled, allocate
+	 * directly, reclaiming memory if need be rather than failing the
+	 * update.
+	 * */
+	if(web_data == NULL) {
+		web_data = new_web_data(GFP_KERNEL);
+	}
+
+	if(web_data != NULL) {
+		rcu_head_init(&web_data->rcu);
+	}
+
+	return web_data;
+}
+
+/*
+ * Returns @web_data to the reserve, no reader may use it anymore.
+ *
+ * Readers only take page references inside a read section, so a page
+ * still shared past this point is referenced by socket buffers in flight,
+ * it cannot be rendered over and is left to them.
+ * */
+static inline void free_web_data_now(struct web_data *web_data) {
+	put_coded_pages(web_data);
+	if(page_ref_count(web_data_page(web_data)) != 1 ||
+			!web_data_pool_put(raw_cpu_ptr(&web_data_pool), web_data)) {
+		destroy_web_data(web_data);
+	}
+}
+
+/*
+ * Synchronization backends, selected by the sync module parameter, see
+ * struct sync_ops.
+ *
+ * Without lockdep, lockdep_is_held() is only declared and the calls to it
+ * must be optimized away: the *_held() ops end up in the tables, so they
+ * test CONFIG_LOCKDEP themselves.
+ * */
+/*
+ * For the backends which cannot track a grace period in the background,
+ * their cond_synchronize() waits for all the readers.
+ * */
+static unsigned long sync_start_synchronize(bool expedited) {
+	return 0;
+}
+
+/*
+ * RCU: lock-free readers, writers serialized by server_mutex, replaced
+ * versions freed after a grace period.
+ * */
+static void rcu_sync_read_lock(struct sync_read_ctx *ctx) {
+	rcu_read_lock();
+}
+
+static bool rcu_sync_read_unlock(struct sync_read_ctx *ctx) {
+	rcu_read_unlock();
+	return false;
+}
+
+static void rcu_sync_write_lock(void) {
+	spin_lock(&server_mutex);
+}
+
+static void rcu_sync_write_unlock(void) {
+	spin_unlock(&server_mutex);
+}
+
+static bool rcu_sync_write_held(void) {
+	return !IS_ENABLED(CONFIG_LOCKDEP) || lockdep_is_held(&server_mutex);
+}
+
+/*
+ * Expedited grace periods IPI every CPU instead of waiting for them to
+ * pass through a quiescent state on their own. */
+static unsigned long rcu_sync_start_synchronize(bool expedited) {
+	if(expedited) {
+		return start_poll_synchronize_rcu_expedited();
+	}
+
+	return start_poll_synchronize_rcu();
+}
+
+static void rcu_sync_cond_synchronize(unsigned long cookie,
+		bool expedited) {
+	if(expedited) {
+		cond_synchronize_rcu_expedited(cookie);
+	} else {
+		cond_synchronize_rcu(cookie);
+	}
+}
+
+static const struct sync_ops rcu_sync_ops = {
+	.name		= "rcu",
+	.read_lock	= rcu_sync_read_lock,
+	.read_unlock	= rcu_sync_read_unlock,
+	.write_lock	= rcu_sync_write_lock,
+	.write_unlock	= rcu_sync_write_unlock,
+	.write_held	= rcu_sync_write_held,
+	.start_synchronize = rcu_sync_start_synchronize,
+	.cond_synchronize = rcu_sync_cond_synchronize,
+};
+
+/*
+ * rwlock_t: readers exclude writers.
+ * */
+static DEFINE_RWLOCK(web_data_rwlock);
+
+static void rwlock_sync_read_lock(struct sync_read_ctx *ctx) {
+	read_lock(&web_data_rwlock);
+}
+
+static bool rwlock_sync_read_unlock(struct sync_read_ctx *ctx) {
+	read_unlock(&web_data_rwlock);
+	return false;
+}
+
+static bool rwlock_sync_write_held(void) {
+	return !IS_ENABLED(CONFIG_LOCKDEP) || lockdep_is_held(&web_data_rwlock);
+}
+
+static void rwlock_sync_write_lock(void) {
+	write_lock(&web_data_rwlock);
+}
+
+static void rwlock_sync_write_unlock(void) {
+	write_unlock(&web_data_rwlock);
+}
+
+static void rwlock_sync_cond_synchronize(unsigned long cookie,
+		bool expedited) {
+	write_lock(&web_data_rwlock);
+	write_unlock(&web_data_rwlock);
+}
+
+static const struct sync_ops rwlock_sync_ops = {
+	.name		= "rwlock",
+	.read_lock	= rwlock_sync_read_lock,
+	.read_unlock	= rwlock_sync_read_unlock,
+	.write_lock	= rwlock_sync_write_lock,
+	.write_unlock	= rwlock_sync_write_unlock,
+	.write_held	= rwlock_sync_write_held,
+	.start_synchronize = sync_start_synchronize,
+	.cond_synchronize = rwlock_sync_cond_synchronize,
+};
+
+/*
+ * seqlock_t: readers never write shared memory but retry when a writer
+ * published meanwhile. Since the version readers found may be replaced
+ * under them, they still need an RCU read section for it to exist.
+ *
+ * A retried section is accounted and traced once per attempt.
+ * */
+static DEFINE_SEQLOCK(web_data_seqlock);
+
+static void seqlock_sync_read_lock(struct sync_read_ctx *ctx) {
+	rcu_read_lock();
+	ctx->seq = read_seqbegin(&web_data_seqlock);
+}
+
+static bool seqlock_sync_read_unlock(struct sync_read_ctx *ctx) {
+	bool retry = read_seqretry(&web_data_seqlock, ctx->seq);
+
+	rcu_read_unlock();
+	return retry;
+}
+
+static void seqlock_sync_write_lock(void) {
+	write_seqlock(&web_data_seqlock);
+}
+
+static void seqlock_sync_write_unlock(void) {
+	write_sequnlock(&web_data_seqlock);
+}
+
+static bool seqlock_sync_write_held(void) {
+	return !IS_ENABLED(CONFIG_LOCKDEP) || lockdep_is_held(&web_data_seqlock.lock);
+}
+
+static const struct sync_ops seqlock_sync_ops = {
+	.name		= "seqlock",
+	.read_lock	= seqlock_sync_read_lock,
+	.read_unlock	= seqlock_sync_read_unlock,
+	.write_lock	= seqlock_sync_write_lock,
+	.write_unlock	= seqlock_sync_write_unlock,
+	.write_held	= seqlock_sync_write_held,
+	.start_synchronize = rcu_sync_start_synchronize,
+	.cond_synchronize = rcu_sync_cond_synchronize,
+};
+
+/*
+ * percpu_rw_semaphore: readers only touch a per CPU counter, writers wait
+ * for a grace period and for all readers to drain. Both sides may sleep.
+ * */
+DEFINE_STATIC_PERCPU_RWSEM(web_data_rwsem);
+
+static void rwsem_sync_read_lock(struct sync_read_ctx *ctx) {
+	percpu_down_read(&web_data_rwsem);
+}
+
+static bool rwsem_sync_read_unlock(struct sync_read_ctx *ctx) {
+	percpu_up_read(&web_data_rwsem);
+	return false;
+}
+
+static bool rwsem_sync_write_held(void) {
+	return !IS_ENABLED(CONFIG_LOCKDEP) || lockdep_is_held(&web_data_rwsem);
+}
+
+static void rwsem_sync_write_lock(void) {
+	percpu_down_write(&web_data_rwsem);
+}
+
+static void rwsem_sync_write_unlock(void) {
+	percpu_up_write(&web_data_rwsem);
+}
+
+static void rwsem_sync_cond_synchronize(unsigned long cookie,
+		bool expedited) {
+	percpu_down_write(&web_data_rwsem);
+	percpu_up_write(&web_data_rwsem);
+}
+
+static const struct sync_ops rwsem_sync_ops = {
+	.name		= "percpu_rwsem",
+	.read_lock	= rwsem_sync_read_lock,
+	.read_unlock	= rwsem_sync_read_unlock,
+	.write_lock	= rwsem_sync_write_lock,
+	.write_unlock	= rwsem_sync_write_unlock,
+	.write_held	= rwsem_sync_write_held,
+	.start_synchronize = sync_start_synchronize,
+	.cond_synchronize = rwsem_sync_cond_synchronize,
+};
+
+static const struct sync_ops *all_sync_ops[] = {
+	&rcu_sync_ops,
+	&rwlock_sync_ops,
+	&seqlock_sync_ops,
+	&rwsem_sync_ops,
+};
+
+static const struct sync_ops *sync_ops __read_mostly = &rcu_sync_ops;
+
+static inline int initialize_sync(void) {
+	int i;
+
+	for(i = 0; i < ARRAY_SIZE(all_sync_ops); i++) {
+		if(sysfs_streq(sync_backend, all_sync_ops[i]->name)) {
+			sync_ops = all_sync_ops[i];
+			return 0;
+		}
+	}
+
+	printk(KERN_ERR "HTTP-SERVER: unknown sync backend %s\n", sync_backend);
+	return -EINVAL;
+}
+
+static int stats_show(struct seq_file *m, void *v) {
+	struct http_stats total = { };
+	struct http_stats *stats;
+	struct content_set *content;
+	u64 generation = 0;
+	int cpu, i;
+
+	rcu_read_lock();
+	content = rcu_dereference(server.content);
+	if(content != NULL) {
+		generation = content->generation;
+	}
+	rcu_read_unlock();
+
+	for_each_possible_cpu(cpu) {
+		stats = per_cpu_ptr(&http_stats, cpu);
+
+		total.normal_responses += READ_ONCE(stats->normal_responses);
+		total.recovery_responses += READ_ONCE(stats->recovery_responses);
+		total.not_modified_responses +=
+			READ_ONCE(stats->not_modified_responses);
+		total.coded_responses += READ_ONCE(stats->coded_responses);
+		total.updates += READ_ONCE(stats->updates);
+		total.recoveries += READ_ONCE(stats->recoveries);
+		total.alloc_failures += READ_ONCE(stats->alloc_failures);
+		total.coalesced_updates += READ_ONCE(stats->coalesced_updates);
+		total.backlog_waits += READ_ONCE(stats->backlog_waits);
+
+		for(i = 0; i < 2; i++) {
+			total.recovery_gps[i] += READ_ONCE(stats->recovery_gps[i]);
+			total.recovery_gp_ns[i] +=
+				READ_ONCE(stats->recovery_gp_ns[i]);
+			total.recovery_window_ns[i] +=
+				READ_ONCE(stats->recovery_window_ns[i]);
+		}
+
+		for(i = 0; i < LATENCY_BUCKETS; i++) {
+			total.read_latency[i] += READ_ONCE(stats->read_latency[i]);
+		}
+	}
+
+	seq_printf(m, "sync: %s\n", sync_ops->name);
+	seq_printf(m, "generation: %llu\n", generation);
+	seq_printf(m, "normal_responses: %llu\n", total.normal_responses);
+	seq_printf(m, "recovery_responses: %llu\n", total.recovery_responses);
+	seq_printf(m, "not_modified_responses: %llu\n",
+			total.not_modified_responses);
+	seq_printf(m, "coded_responses: %llu\n", total.coded_responses);
+	seq_printf(m, "updates: %llu\n", total.updates);
+	seq_printf(m, "recoveries: %llu\n", total.recoveries);
+	seq_printf(m, "alloc_failures: %llu\n", total.alloc_failures);
+	seq_printf(m, "reclaim_backlog: %ld\n",
+			atomic_long_read(&content_backlog));
+	seq_printf(m, "coalesced_updates: %llu\n", total.coalesced_updates);
+	seq_printf(m, "backlog_waits: %llu\n", total.backlog_waits);
+
+	/*
+	 * Averages per recovery, per kind of grace period. */
+	for(i = 0; i < 2; i++) {
+		if(total.recovery_gps[i] == 0) {
+			continue;
+		}
+
+		seq_printf(m, "recovery_gp_%s: %llu recoveries, gp %llu ns, window %llu ns\n",
+				i ? "expedited" : "normal", total.recovery_gps[i],
+				div64_u64(total.recovery_gp_ns[i],
+					total.recovery_gps[i]),
+				div64_u64(total.recovery_window_ns[i],
+					total.recovery_gps[i]));
+	}
+
+	seq_puts(m, "read_section_ns:\n");
+	for(i = 0; i < LATENCY_BUCKETS; i++) {
+		if(total.read_latency[i] == 0) {
+			continue;
+		}
+
+		seq_printf(m, "  [%llu, %llu): %llu\n", i ? 1ULL << i : 0,
+				1ULL << (i + 1), total.read_latency[i]);
+	}
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(stats);
+
+static inline void initialize_stats(void) {
+	debugfs_dir = debugfs_create_dir("http_server_rcu", NULL);
+	debugfs_create_file("stats", 0444, debugfs_dir, NULL, &stats_fops);
+}
+
+static inline void clean_up_stats(void) {
+	debugfs_remove_recursive(debugfs_dir);
+}
+
+/*
+ * Renders both variants of @response into its page from @off on, @headers
+ * being complete header lines. The body is copied as is, it may be
+ * binary. Without @body, the response has no content and neither
+ * Content-Type nor Content-Length, as a 304 must not announce a length
+ * other than the one of the full response.
+ *
+ * Returns the offset past them, or -E2BIG if they do not fit in the page:
+ * a response is never cut short of the length it announces.
+ * */
+static inline int render_response(struct http_response *response,
+		unsigned int off, const char *status, const char *headers,
+		const void *body, int body_len) {
+	static const char * const connection[] = {
+		[HTTP_KEEP_ALIVE] = "keep-alive",
+		[HTTP_CLOSE] = "close",
+	};
+	char *buf = page_address(response->page);
+	int i, len;
+
+	if(body == NULL) {
+		body_len = 0;
+	}
+
+	for(i = 0; i < NR_HTTP_DISPOSITIONS; i++) {
+		if(body != NULL) {
+			len = snprintf(buf + off, PAGE_SIZE - off,
+					"HTTP/1.1 %s\r\n"
+					"Content-Type: text/plain\r\n"
+					"Content-Length: %d\r\n"
+					"Connection: %s\r\n"
+					"%s"
+					"\r\n", status, body_len,
+					connection[i], headers);
+		} else {
+			len = snprintf(buf + off, PAGE_SIZE - off,
+					"HTTP/1.1 %s\r\n"
+					"Connection: %s\r\n"
+					"%s"
+					"\r\n", status, connection[i], headers);
+		}
+
+		if(len + body_len > PAGE_SIZE - off) {
+			return -E2BIG;
+		}
+
+		if(body != NULL) {
+			memcpy(buf + off + len, body, body_len);
+			len += body_len;
+		}
+
+		response->off[i] = off;
+		response->len[i] = len;
+		off += len;
+	}
+
+	return off;
+}
+
+static const char * const http_days[] = {
+	"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat",
+};
+
+static const char * const http_months[] = {
+	"Jan", "Feb", "Mar", "Apr", "May", "Jun",
+	"Jul", "Aug", "Sep", "Oct", "Nov", "Dec",
+};
+
+/*
+ * Random per load, part of every etag so that the etags handed out
+ * before a reload, whose generations start over, never match. */
+static u32 http_etag_epoch;
+
+/*
+ * Compression of the coded responses, only done while rendering a version
+ * in a transaction, hence serialized by content_mutex.
+ *
+ * The kernel zlib has no gzip wrapper, gzip is a raw deflate stream framed
+ * here. deflate is the zlib format, as HTTP defines it.
+ * */
+static struct {
+	struct z_stream_s stream;
+	u8 *out;
+} http_zlib;
+
+static const u8 gzip_header[] = {
+	0x1f, 0x8b, Z_DEFLATED, 0, 0, 0, 0, 0, 0, 3,
+};
+
+/*
+ * Compresses @body into http_zlib.out.
+ *
+ * Returns the compressed length, or -1 if it would not be shorter than
+ * @body_len.
+ * */
+static inline int http_compress(enum http_coding coding, const char *body,
+		int body_len) {
+	struct z_stream_s *stream = &http_zlib.stream;
+	int header = 0, trailer = 0, ret;
+	__le32 gzip_trailer[2];
+
+	if(coding == HTTP_CODING_GZIP) {
+		header = sizeof(gzip_header);
+		trailer = sizeof(gzip_trailer);
+	}
+
+	if(body_len <= header + trailer) {
+		return -1;
+	}
+
+	if(zlib_deflateInit2(stream, Z_BEST_COMPRESSION, Z_DEFLATED,
+				coding == HTTP_CODING_GZIP ? -MAX_WBITS : MAX_WBITS,
+				MAX_MEM_LEVEL, Z_DEFAULT_STRATEGY) != Z_OK) {
+		return -1;
+	}
+
+	stream->next_in = (const u8 *)body;
+	stream->avail_in = body_len;
+	stream->next_out = http_zlib.out + header;
+	stream->avail_out = body_len - 1 - header - trailer;
+
+	ret = zlib_deflate(stream, Z_FINISH);
+	zlib_deflateEnd(stream);
+	if(ret != Z_STREAM_END) {
+		return -1;
+	}
+
+	if(coding == HTTP_CODING_GZIP) {
+		memcpy(http_zlib.out, gzip_header, header);
+		gzip_trailer[0] = cpu_to_le32(crc32_le(~0,
+					(const u8 *)body, body_len) ^ ~0);
+		gzip_trailer[1] = cpu_to_le32(body_len);
+		memcpy(stream->next_out, gzip_trailer, trailer);
+	}
+
+	return header + stream->total_out + trailer;
+}
+
+/*
+ * Renders the representation of @web_data in @coding, whose page is
+ * allocated, @headers being the ones common to all representations.
+ *
+ * The etag of the identity representation is "<epoch>-<version>", the
+ * name of the coding is appended for the others.
+ * */
+static inline int render_representation(struct web_data *web_data,
+		enum http_coding coding, const char *headers, const void *body,
+		int body_len) {
+	struct http_representation *repr = &web_data->render.repr[coding];
+	char repr_headers[HTTP_ETAG_MAX + 192];
+	int off;
+
+	if(coding == HTTP_CODING_IDENTITY) {
+		repr->etag_len = scnprintf(repr->etag, sizeof(repr->etag),
+				"\"%08x-%llx\"", http_etag_epoch,
+				web_data->version);
+		scnprintf(repr_headers, sizeof(repr_headers),
+				"ETag: %s\r\n%s", repr->etag, headers);
+	} else {
+		repr->etag_len = scnprintf(repr->etag, sizeof(repr->etag),
+				"\"%08x-%llx-%s\"", http_etag_epoch,
+				web_data->version, http_coding_names[coding]);
+		scnprintf(repr_headers, sizeof(repr_headers),
+				"Content-Encoding: %s\r\nETag: %s\r\n%s",
+				http_coding_names[coding], repr->etag, headers);
+	}
+
+	repr->not_modified.page = repr->response.page;
+	off = render_response(&repr->response, 0, "200 OK", repr_headers,
+			body, body_len);
+	if(off < 0) {
+		return off;
+	}
+
+	off = render_response(&repr->not_modified, off, "304 Not Modified",
+			repr_headers, NULL, 0);
+	if(off < 0) {
+		return off;
+	}
+
+	return 0;
+}
+
+/*
+ * Renders the coded representations of @web_data which make the body
+ * smaller and fit in a page.
+ * */
+static inline void render_coded(struct web_data *web_data,
+		const char *headers, const char *body, int body_len) {
+	int i, len;
+
+	if(body_len < HTTP_COMPRESS_MIN) {
+		return;
+	}
+
+	for(i = 0; i < HTTP_CODING_IDENTITY; i++) {
+		len = http_compress(i, body, body_len);
+		if(len < 0) {
+			continue;
+		}
+
+		web_data->render.repr[i].response.page = alloc_page(GFP_KERNEL);
+		if(web_data->render.repr[i].response.page == NULL) {
+			continue;
+		}
+
+		if(render_representation(web_data, i, headers, http_zlib.out,
+					len)) {
+			put_page(web_data->render.repr[i].response.page);
+			web_data->render.repr[i].response.page = NULL;
+			web_data->render.repr[i].not_modified.page = NULL;
+		}
+	}
+}
+
+static inline int initialize_compression(void) {
+	http_zlib.stream.workspace = vzalloc(zlib_deflate_workspacesize(
+				MAX_WBITS, MAX_MEM_LEVEL));
+	http_zlib.out = kmalloc(HTTP_BODY_MAX, GFP_KERNEL);
+	if(http_zlib.stream.workspace == NULL || http_zlib.out == NULL) {
+		vfree(http_zlib.stream.workspace);
+		kfree(http_zlib.out);
+		http_zlib.stream.workspace = NULL;
+		http_zlib.out = NULL;
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+
+/*
+ * Must be called once no version can be rendered anymore.
+ * */
+static inline void clean_up_compression(void) {
+	vfree(http_zlib.stream.workspace);
+	kfree(http_zlib.out);
+	http_zlib.stream.workspace = NULL;
+	http_zlib.out = NULL;
+}
+
+/*
+ * Stamps @web_data as the version published by @txn and renders its
+ * representations, must be called before the version is published.
+ *
+ * Returns -E2BIG if the identity representation does not fit in a page.
+ * */
+static inline int render_resource(struct web_data *web_data,
+		const struct content_txn *txn, const char *body, int body_len) {
+	char headers[96];
+	struct tm tm;
+	int err;
+
+	web_data->version = txn->new->generation;
+	web_data->render.modified = ktime_get_real_seconds();
+
+	time64_to_tm(web_data->render.modified, 0, &tm);
+	scnprintf(headers, sizeof(headers),
+			"Vary: Accept-Encoding\r\n"
+			"Last-Modified: %s, %02d %s %04ld %02d:%02d:%02d GMT\r\n",
+			http_days[tm.tm_wday], tm.tm_mday,
+			http_months[tm.tm_mon], tm.tm_year + 1900, tm.tm_hour,
+			tm.tm_min, tm.tm_sec);
+
+	err = render_representation(web_data, HTTP_CODING_IDENTITY, headers,
+			body, body_len);
+	if(err) {
+		return err;
+	}
+
+	render_coded(web_data, headers, body, body_len);
+
+	return 0;
+}
+
+/*
+ * Renders the response for web_data->message. */
+static inline int render_web_data(struct web_data *web_data,
+		const struct content_txn *txn) {
+	char body[16];
+	int body_len;
+
+	body_len = scnprintf(body, sizeof(body), "%d\n", web_data->message);
+	return render_resource(web_data, txn, body, body_len);
+}
+
+/*
+ * Responses which do not depend on any version, rendered at load.
+ * */
+static struct http_response careful_response;
+static struct http_response bad_request_response;
+static struct http_response not_found_response;
+static struct http_response not_allowed_response;
+static struct http_response forbidden_response;
+static struct http_response too_large_response;
+
+static struct {
+	struct http_response *response;
+	const char *status;
+	const char *body;
+} static_responses[] = {
+	{ &careful_response, "438 Recovery", "Mode: Recovery\n" },
+	{ &bad_request_response, "400 Bad Request", "" },
+	{ &not_found_response, "404 Not Found", "" },
+	{ &not_allowed_response, "405 Method Not Allowed", "" },
+	{ &forbidden_response, "403 Forbidden", "" },
+	{ &too_large_response, "413 Content Too Large", "" },
+};
+
+static inline void free_static_responses(void) {
+	int i;
+
+	for(i = 0; i < ARRAY_SIZE(static_responses); i++) {
+		if(static_responses[i].response->page != NULL) {
+			put_page(static_responses[i].response->page);
+			static_responses[i].response->page = NULL;
+		}
+	}
+}
+
+static inline int render_static_responses(void) {
+	struct http_response *response;
+	int i, off;
+
+	for(i = 0; i < ARRAY_SIZE(static_responses); i++) {
+		response = static_responses[i].response;
+
+		response->page = alloc_page(GFP_KERNEL);
+		if(response->page == NULL) {
+			free_static_responses();
+			return -ENOMEM;
+		}
+
+		off = render_response(response, 0, static_responses[i].status,
+				"", static_responses[i].body,
+				strlen(static_responses[i].body));
+		if(off < 0) {
+			free_static_responses();
+			return off;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Static resources, published and removed through debugfs:
+ *
+ *	echo "/hello Hello" > /sys/kernel/debug/http_server_rcu/publish
+ *	echo "/hello" > /sys/kernel/debug/http_server_rcu/unpublish
+ *
+ * Every write is a transaction over server.content: it may hold any
+ * number of lines, one resource per line, and its changes become visible
+ * together in one generation, or not at all if any line is refused. The
+ * body of a resource is the rest of its line. "/" is owned by the updater
+ * and the recovery thread.
+ * */
+static inline int check_resource_path(const struct web_data_key *key) {
+	if(key->len == 0 || key->len > HTTP_PATH_MAX || key->path[0] != '/') {
+		return -EINVAL;
+	}
+
+	if(web_data_key_equal(key, &root_key)) {
+		return -EPERM;
+	}
+
+	return 0;
+}
+
+static inline int stage_resource(struct content_txn *txn,
+		const struct web_data_key *key, const char *body,
+		size_t body_len) {
+	struct web_data *web_data;
+	int err;
+
+	err = check_resource_path(key);
+	if(err) {
+		return err;
+	}
+
+	if(body_len > HTTP_BODY_MAX) {
+		return -E2BIG;
+	}
+
+	web_data = alloc_web_data();
+	if(web_data == NULL) {
+		return -ENOMEM;
+	}
+
+	set_web_data_path(web_data, key->path, key->len);
+	web_data->message = 0;
+	err = render_resource(web_data, txn, body, body_len);
+	if(!err) {
+		err = content_txn_put(txn, web_data);
+	}
+	if(err) {
+		free_web_data_now(web_data);
+	}
+
+	return err;
+}
+
+static inline int stage_removal(struct content_txn *txn,
+		const struct web_data_key *key) {
+	int err;
+
+	err = check_resource_path(key);
+	if(err) {
+		return err;
+	}
+
+	return content_txn_remove(txn, key);
+}
+
+/*
+ * Publishes the generation staged by @txn, or drops it on @err.
+ * */
+static inline ssize_t commit_resources(struct content_txn *txn, int err,
+		size_t count) {
+	if(err) {
+		content_txn_abort(txn);
+		return err;
+	}
+
+	content_txn_publish(txn);
+	content_txn_finish(txn);
+
+	return count;
+}
+
+static ssize_t publish_write(struct file *file, const char __user *ubuf,
+		size_t count, loff_t *ppos) {
+	struct web_data_key key;
+	struct content_txn txn;
+	char *buf, *line, *end, *body;
+	int err;
+
+	if(count > HTTP_PUBLISH_SIZE) {
+		return -E2BIG;
+	}
+
+	buf = memdup_user_nul(ubuf, count);
+	if(IS_ERR(buf)) {
+		return PTR_ERR(buf);
+	}
+
+	err = content_txn_begin(&txn);
+	if(err) {
+		kfree(buf);
+		return err;
+	}
+
+	for(line = buf; *line != '\0' && !err; line = end) {
+		end = strchrnul(line, '\n');
+		if(*end == '\n') {
+			end++;
+		}
+
+		body = memchr(line, ' ', end - line);
+		if(body == NULL) {
+			err = -EINVAL;
+			break;
+		}
+
+		key.path = line;
+		key.len = body - line;
+		body++;
+
+		err = stage_resource(&txn, &key, body, end - body);
+	}
+
+	kfree(buf);
+
+	return commit_resources(&txn, err, count);
+}
+
+static ssize_t unpublish_write(struct file *file, const char __user *ubuf,
+		size_t count, loff_t *ppos) {
+	struct web_data_key key;
+	struct content_txn txn;
+	char *buf, *cur, *line;
+	int err;
+
+	if(count > HTTP_PUBLISH_SIZE) {
+		return -E2BIG;
+	}
+
+	buf = memdup_user_nul(ubuf, count);
+	if(IS_ERR(buf)) {
+		return PTR_ERR(buf);
+	}
+
+	err = content_txn_begin(&txn);
+	if(err) {
+		kfree(buf);
+		return err;
+	}
+
+	cur = buf;
+	while((line = strsep(&cur, "\n")) != NULL && !err) {
+		key.path = strim(line);
+		key.len = strlen(key.path);
+		if(key.len > 0) {
+			err = stage_removal(&txn, &key);
+		}
+	}
+
+	kfree(buf);
+
+	return commit_resources(&txn, err, count);
+}
+
+static const struct file_operations publish_fops = {
+	.owner	= THIS_MODULE,
+	.write	= publish_write,
+	.llseek	= noop_llseek,
+};
+
+static const struct file_operations unpublish_fops = {
+	.owner	= THIS_MODULE,
+	.write	= unpublish_write,
+	.llseek	= noop_llseek,
+};
+
+/*
+ * Longest prefix router.
+ *
+ * The routing table is an immutable path compressed trie over the bytes
+ * of the route prefixes, built off to the side and published as a whole
+ * with rcu_assign_pointer(). Readers walk it without any lock nor atomic
+ * operation, and replacing it never blocks them, the previous table is
+ * freed after a grace period.
+ *
+ * The table is written through debugfs, one route per line:
+ *
+ *	<prefix> resource		serve the resource at the request path
+ *	<prefix> document <path>	serve the resource at <path>
+ *	<prefix> deny			answer 403
+ *
+ * Requests matching no prefix are answered 404.
+ * */
+enum http_handler {
+	HTTP_HANDLER_RESOURCE,
+	HTTP_HANDLER_DOCUMENT,
+	HTTP_HANDLER_DENY,
+};
+
+static const char * const http_handler_names[] = {
+	[HTTP_HANDLER_RESOURCE] = "resource",
+	[HTTP_HANDLER_DOCUMENT] = "document",
+	[HTTP_HANDLER_DENY] = "deny",
+};
+
+struct http_route {
+	struct web_data_key prefix;
+	enum http_handler handler;
+	struct web_data_key target;
+};
+
+/*
+ * A trie node, reached through the edge label. Its children are
+ * contiguous in http_router.nodes and sorted by the first byte of their
+ * label. route is the index of the route ending here, or -1.
+ * */
+struct http_route_node {
+	const char *label;
+	unsigned int label_len;
+	int route;
+	unsigned int child;
+	unsigned int nr_children;
+};
+
+/*
+ * A single allocation: the routes, the trie, whose root is nodes[0], and
+ * the text the table was parsed from, which the routes and labels point
+ * into.
+ * */
+struct http_router {
+	struct rcu_head rcu;
+	unsigned int nr_routes;
+	unsigned int nr_nodes;
+	struct http_route *routes;
+	struct http_route_node *nodes;
+	char text[];
+};
+
+static DEFINE_MUTEX(router_mutex);
+
+static const char default_routes[] = "/ resource\n";
+
+/*
+ * Returns the route with the longest prefix of @key, NULL if none.
+ * */
+static inline const struct http_route *http_route_lookup(
+		const struct http_router *router,
+		const struct web_data_key *key) {
+	const struct http_route_node *node = &router->nodes[0], *child;
+	const struct http_route *best = NULL;
+	unsigned int depth = 0, lo, hi, mid;
+	unsigned char c;
+
+	for(;;) {
+		if(node->route >= 0) {
+			best = &router->routes[node->route];
+		}
+
+		if(depth == key->len || node->nr_children == 0) {
+			break;
+		}
+
+		c = key->path[depth];
+		lo = node->child;
+		hi = node->child + node->nr_children;
+		child = NULL;
+		while(lo < hi) {
+			mid = lo + (hi - lo) / 2;
+			if((unsigned char)router->nodes[mid].label[0] < c) {
+				lo = mid + 1;
+			} else {
+				hi = mid;
+			}
+		}
+		if(lo < node->child + node->nr_children &&
+				(unsigned char)router->nodes[lo].label[0] == c) {
+			child = &router->nodes[lo];
+		}
+
+		if(child == NULL || child->label_len > key->len - depth ||
+				memcmp(child->label, key->path + depth,
+					child->label_len)) {
+			break;
+		}
+
+		depth += child->label_len;
+		node = child;
+	}
+
+	return best;
+}
+
+static int http_route_cmp(const void *a, const void *b) {
+	const struct http_route *ra = a, *rb = b;
+
+	return strcmp(ra->prefix.path, rb->prefix.path);
+}
+
+/*
+ * Fills the children of @node, the routes [lo, hi) all share their first
+ * @depth bytes and are longer than that.
+ * */
+static void router_build_children(struct http_router *router,
+		struct http_route_node *node, unsigned int lo, unsigned int hi,
+		unsigned int depth) {
+	struct http_route *routes = router->routes;
+	struct http_route_node *child;
+	unsigned int i, j, end;
+
+	node->child = router->nr_nodes;
+	node->nr_children = 0;
+	for(i = lo; i < hi; i = j) {
+		for(j = i + 1; j < hi && routes[j].prefix.path[depth] ==
+				routes[i].prefix.path[depth]; j++);
+		node->nr_children++;
+	}
+	router->nr_nodes += node->nr_children;
+
+	child = &router->nodes[node->child];
+	for(i = lo; i < hi; i = j, child++) {
+		for(j = i + 1; j < hi && routes[j].prefix.path[depth] ==
+				routes[i].prefix.path[depth]; j++);
+
+		/*
+		 * Routes are sorted, hence [i, j) share the bytes on which
+		 * their first and last one agree, and a route which is a
+		 * prefix of the others comes first.
+		 * */
+		end = depth + 1;
+		while(routes[i].prefix.path[end] != '\0' &&
+				routes[i].prefix.path[end] ==
+				routes[j - 1].prefix.path[end]) {
+			end++;
+		}
+
+		child->label = routes[i].prefix.path + depth;
+		child->label_len = end - depth;
+		child->route = -1;
+		if(routes[i].prefix.len == end) {
+			child->route = i++;
+		}
+
+		router_build_children(router, child, i, j, end);
+	}
+}
+
+static char *next_token(char **line) {
+	char *token;
+
+	do {
+		token = strsep(line, " \t");
+	} while(token != NULL && *token == '\0');
+
+	return token;
+}
+
+/*
+ * Parses one "<prefix> <handler> [<path>]" line into @route, in place.
+ * */
+static int parse_route(char *line, struct http_route *route) {
+	char *prefix, *handler, *target;
+	int ret;
+
+	prefix = next_token(&line);
+	handler = next_token(&line);
+	target = next_token(&line);
+
+	if(handler == NULL || next_token(&line) != NULL || prefix[0] != '/' ||
+			strlen(prefix) > HTTP_PATH_MAX) {
+		return -EINVAL;
+	}
+
+	ret = match_string(http_handler_names,
+			ARRAY_SIZE(http_handler_names), handler);
+	if(ret < 0) {
+		return ret;
+	}
+
+	route->prefix.path = prefix;
+	route->prefix.len = strlen(prefix);
+	route->handler = ret;
+	route->target.path = NULL;
+	route->target.len = 0;
+
+	if((ret == HTTP_HANDLER_DOCUMENT) != (target != NULL)) {
+		return -EINVAL;
+	}
+
+	if(target != NULL) {
+		if(target[0] != '/' || strlen(target) > HTTP_PATH_MAX) {
+			return -EINVAL;
+		}
+		route->target.path = target;
+		route->target.len = strlen(target);
+	}
+
+	return 0;
+}
+
+/*
+ * Builds a routing table from @text, @len bytes long.
+ * */
+static struct http_router *build_router(const char *text, size_t len) {
+	struct http_router *router;
+	unsigned int nr = 0, i;
+	char *line, *cur;
+	size_t size;
+	int err;
+
+	for(i = 0; i < len; i++) {
+		nr += text[i] == '\n';
+	}
+	nr++;
+
+	if(nr > HTTP_ROUTES_MAX) {
+		return ERR_PTR(-E2BIG);
+	}
+
+	size = sizeof(*router) + len + 1;
+	size = ALIGN(size, sizeof(void *));
+	router = kzalloc(size + nr * sizeof(*router->routes) +
+			(2 * nr + 1) * sizeof(*router->nodes), GFP_KERNEL);
+	if(router == NULL) {
+		return ERR_PTR(-ENOMEM);
+	}
+
+	router->routes = (void *)router + size;
+	router->nodes = (void *)(router->routes + nr);
+	memcpy(router->text, text, len);
+
+	cur = router->text;
+	while((line = strsep(&cur, "\n")) != NULL) {
+		line = strim(line);
+		if(*line == '\0' || *line == '#') {
+			continue;
+		}
+
+		err = parse_route(line, &router->routes[router->nr_routes]);
+		if(err) goto err;
+		router->nr_routes++;
+	}
+
+	sort(router->routes, router->nr_routes, sizeof(*router->routes),
+			http_route_cmp, NULL);
+
+	for(i = 1; i < router->nr_routes; i++) {
+		if(!strcmp(router->routes[i - 1].prefix.path,
+					router->routes[i].prefix.path)) {
+			err = -EEXIST;
+			goto err;
+		}
+	}
+
+	router->nodes[0].label = "";
+	router->nodes[0].route = -1;
+	router->nr_nodes = 1;
+	router_build_children(router, &router->nodes[0], 0,
+			router->nr_routes, 0);
+
+	return router;
+
+err:
+	kfree(router);
+	return ERR_PTR(err);
+}
+
+/*
+ * Publishes a new routing table, requests in flight keep using the
+ * previous one until their read section ends.
+ * */
+static int replace_router(const char *text, size_t len) {
+	struct http_router *router;
+
+	router = build_router(text, len);
+	if(IS_ERR(router)) {
+		return PTR_ERR(router);
+	}
+
+	mutex_lock(&router_mutex);
+	router = rcu_replace_pointer(server.router, router,
+			lockdep_is_held(&router_mutex));
+	mutex_unlock(&router_mutex);
+
+	if(router != NULL) {
+		kfree_rcu(router, rcu);
+	}
+
+	return 0;
+}
+
+static ssize_t routes_write(struct file *file, const char __user *ubuf,
+		size_t count, loff_t *ppos) {
+	char *buf;
+	int err;
+
+	if(count > HTTP_ROUTES_SIZE) {
+		return -E2BIG;
+	}
+
+	buf = memdup_user_nul(ubuf, count);
+	if(IS_ERR(buf)) {
+		return PTR_ERR(buf);
+	}
+
+	err = replace_router(buf, count);
+	kfree(buf);
+
+	return err ? err : count;
+}
+
+static int routes_show(struct seq_file *m, void *v) {
+	const struct http_router *router;
+	const struct http_route *route;
+	int i;
+
+	rcu_read_lock();
+	router = rcu_dereference(server.router);
+	for(i = 0; router && i < router->nr_routes; i++) {
+		route = &router->routes[i];
+		seq_printf(m, "%s %s", route->prefix.path,
+				http_handler_names[route->handler]);
+		if(route->target.path != NULL) {
+			seq_printf(m, " %s", route->target.path);
+		}
+		seq_putc(m, '\n');
+	}
+	rcu_read_unlock();
+
+	return 0;
+}
+
+static int routes_open(struct inode *inode, struct file *file) {
+	return single_open(file, routes_show, inode->i_private);
+}
+
+static const struct file_operations routes_fops = {
+	.owner		= THIS_MODULE,
+	.open		= routes_open,
+	.read		= seq_read,
+	.write		= routes_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static inline int initialize_router(void) {
+	return replace_router(default_routes, sizeof(default_routes) - 1);
+}
+
+/*
+ * Must be called once no request is being served anymore.
+ * */
+static inline void clean_up_router(void) {
+	kfree(rcu_replace_pointer(server.router, NULL, true));
+}
+
+/*
+ * Must be called after initialize_stats().
+ * */
+static inline void initialize_publishing(void) {
+	debugfs_create_file("publish", 0200, debugfs_dir, NULL, &publish_fops);
+	debugfs_create_file("unpublish", 0200, debugfs_dir, NULL,
+			&unpublish_fops);
+	debugfs_create_file("routes", 0600, debugfs_dir, NULL, &routes_fops);
+}
+
+static inline int initialize_web_data_cache(void) {
+	int cpu, err;
+
+	web_data_cache = KMEM_CACHE(web_data, SLAB_HWCACHE_ALIGN);
+	if(web_data_cache == NULL) {
+		return -ENOMEM;
+	}
+
+	err = render_static_responses();
+	if(err) {
+		kmem_cache_destroy(web_data_cache);
+		web_data_cache = NULL;
+		return err;
+	}
+
+	for_each_possible_cpu(cpu) {
+		spin_lock_init(&per_cpu_ptr(&web_data_pool, cpu)->lock);
+	}
+
+	refill_web_data_pools(NULL);
+
+	return 0;
+}
+
+/*
+ * Must be called once no thread uses server.content anymore.
+ * */
+static inline void clean_up_web_data_cache(void) {
+	struct web_data_pool *pool;
+	int cpu;
+
+	if(web_data_cache == NULL) {
+		return;
+	}
+
+	clean_up_content();
+	cancel_work_sync(&web_data_refill_work);
+
+	for_each_possible_cpu(cpu) {
+		pool = per_cpu_ptr(&web_data_pool, cpu);
+		while(pool->nr > 0) {
+			destroy_web_data(pool->objs[--pool->nr]);
+		}
+	}
+
+	kmem_cache_destroy(web_data_cache);
+	web_data_cache = NULL;
+
+	free_static_responses();
+}
+
+static inline int initialize_server(void) {
+	int err;
+
+	INIT_LIST_HEAD(&server.clients);
+
+	err = initialize_web_data_cache();
+	if(err) goto err;
+
+	err = initialize_compression();
+	if(err) goto err;
+
+	http_etag_epoch = get_random_u32();
+
+	err = initialize_web_data();
+	if(err) goto err;
+
+	err = initialize_router();
+	if(err) goto err;
+
+	err = initialize_state();
+	if(err) goto err;
+
+	err = initialize_time();
+	if(err) goto err;
+
+	return 0;
+
+err:
+	return err;
+}
+
+/*
+ * Network counterpart of send_data_carefully(), returns the 438 response
+ * without touching server.content. */
+static inline struct http_response *format_data_carefully(int id) {
+	http_stats_inc(recovery_responses);
+	trace_recovery_response(id);
+
+	return &careful_response;
+}
+
+/*
+ * The coding of the representation of @web_data served to a client
+ * accepting @codings: the preferred one which was precomputed, identity
+ * if none was. */
+static inline enum http_coding http_select_coding(
+		const struct web_data *web_data, unsigned int codings) {
+	int i;
+
+	for(i = 0; i < HTTP_CODING_IDENTITY; i++) {
+		if((codings & (1U << i)) &&
+				web_data->render.repr[i].response.page != NULL) {
+			return i;
+		}
+	}
+
+	return HTTP_CODING_IDENTITY;
+}
+
+/*
+ * Network counterpart of send_data(), must be called in a read section.
+ *
+ * @web_data is looked up by the caller so that every response of a batch
+ * comes from the same generation, and its representation in @coding is
+ * served: its 304 response if @not_modified, its 200 one otherwise. */
+static inline struct http_response *format_data(int id,
+		struct web_data *web_data, enum http_coding coding,
+		bool not_modified) {
+	struct http_representation *repr = &web_data->render.repr[coding];
+
+	trace_response_sent(id, not_modified ? 304 : 200, web_data->message);
+
+	if(not_modified) {
+		http_stats_inc(not_modified_responses);
+		return &repr->not_modified;
+	}
+
+	if(coding == HTTP_CODING_IDENTITY) {
+		http_stats_inc(normal_responses);
+	} else {
+		http_stats_inc(coded_responses);
+	}
+
+	return &repr->response;
+}
+
+/*
+ * Client thread */
+static inline int setup_client(void *data) {
+	int timeout = *(int*)data;
+
+	while(!kthread_should_stop()) {
+		client_read(timeout/timeout_multiplier);
+	
+		msleep_interruptible(timeout*1000);
+	}
+
+	return 0;
+}
+
+/*
+ * Thread created for recovering the server, see recover_system().
+ * */
+static inline int recover_system_thread(void *data) {
+	while(!kthread_should_stop()) {
+		msleep_interruptible(READ_ONCE(time_before_recovery)*1000);
+
+		recover_system();
+
+		set_current_state(TASK_INTERRUPTIBLE);
+		schedule();
+	}
+
+	return 0;
+}
+
+/*
+ * Code run by updater threads.
+ * Protection using RCU primitives, see updater_step().
+ * */
+static inline int updater_thread(void *data) {
+	unsigned int pending = 0;
+
+	while(!kthread_should_stop()) {
+		updater_step(&pending);
+
+		msleep_interruptible(READ_ONCE(update_frequency)*1000);
+	}
+
+	return 0;
+}
+
+/*
+ * Benchmark mode.
+ *
+ * Instead of the simulation, bench_readers threads run client_read() and
+ * bench_updaters threads run publish_updates() back to back for
+ * bench_duration seconds. Readers are spread over the online CPUs, one
+ * per CPU first. Grace periods are counted by an RCU callback which
+ * re-queues itself as long as the benchmark runs, every invocation means
+ * at least one grace period elapsed.
+ *
+ * Results are printed and kept in /sys/kernel/debug/http_server_rcu/bench.
+ * */
+struct bench_thread {
+	struct task_struct	*task;
+	int			cpu;
+	u64			ops;
+};
+
+struct bench {
+	bool			running;
+	bool			done;
+	u64			elapsed_ns;
+	u64			grace_periods;
+	int			nr_readers;
+	int			nr_updaters;
+	struct bench_thread	*readers;
+	struct bench_thread	*updaters;
+	struct rcu_head		gp_probe;
+};
+
+static struct bench bench;
+
+static void bench_gp_probe(struct rcu_head *head) {
+	bench.grace_periods++;
+
+	if(READ_ONCE(bench.running)) {
+		call_rcu(head, bench_gp_probe);
+	}
+}
+
+/*
+ * Parks the current thread until kthread_stop() is called on it. */
+static inline void wait_for_stop(void) {
+	set_current_state(TASK_INTERRUPTIBLE);
+	while(!kthread_should_stop()) {
+		schedule();
+		set_current_state(TASK_INTERRUPTIBLE);
+	}
+	__set_current_state(TASK_RUNNING);
+}
+
+static int bench_reader_thread(void *data) {
+	struct bench_thread *thread = data;
+	u64 ops = 0;
+
+	while(READ_ONCE(bench.running)) {
+		client_read(thread->cpu);
+		if(!(++ops & 1023)) {
+			cond_resched();
+		}
+	}
+
+	thread->ops = ops;
+	wait_for_stop();
+
+	return 0;
+}
+
+static int bench_updater_thread(void *data) {
+	struct bench_thread *thread = data;
+	u64 ops = 0;
+
+	while(READ_ONCE(bench.running)) {
+		ops += bench_updater_step();
+		cond_resched();
+	}
+
+	thread->ops = ops;
+	wait_for_stop();
+
+	return 0;
+}
+
+static inline int create_bench_threads(struct bench_thread *threads, int n,
+		int (*fn)(void *), const char *name, const struct cpumask *cpus) {
+	int i, cpu = -1;
+
+	for(i = 0; i < n; i++) {
+		cpu = cpumask_next(cpu, cpus);
+		if(cpu >= nr_cpu_ids) {
+			cpu = cpumask_first(cpus);
+		}
+
+		threads[i].cpu = cpu;
+		threads[i].task = kthread_create(fn, &threads[i], "%s%d", name, i);
+		if(IS_ERR(threads[i].task)) {
+			threads[i].task = NULL;
+			return -ENOMEM;
+		}
+
+		kthread_bind(threads[i].task, cpu);
+	}
+
+	return 0;
+}
+
+static inline void stop_bench_threads(struct bench_thread *threads, int n) {
+	int i;
+
+	for(i = 0; i < n; i++) {
+		if(threads[i].task != NULL) {
+			kthread_stop(threads[i].task);
+			threads[i].task = NULL;
+		}
+	}
+}
+
+static inline void wake_bench_threads(struct bench_thread *threads, int n) {
+	int i;
+
+	for(i = 0; i < n; i++) {
+		wake_up_process(threads[i].task);
+	}
+}
+
+static inline u64 bench_rate(u64 ops) {
+	return bench.elapsed_ns ? div64_u64(ops * NSEC_PER_SEC, bench.elapsed_ns) : 0;
+}
+
+static inline void bench_report(void) {
+	u64 reads = 0, updates = 0;
+	int i;
+
+	for(i = 0; i < bench.nr_readers; i++) {
+		reads += bench.readers[i].ops;
+		printk(KERN_INFO "HTTP-SERVER: bench reader %d cpu %d: %llu reads/s\n",
+				i, bench.readers[i].cpu,
+				bench_rate(bench.readers[i].ops));
+	}
+
+	for(i = 0; i < bench.nr_updaters; i++) {
+		updates += bench.updaters[i].ops;
+	}
+
+	printk(KERN_INFO "HTTP-SERVER: bench %s %d readers %d updaters %llu ms: %llu reads/s %llu updates/s %llu grace periods\n",
+			sync_ops->name, bench.nr_readers, bench.nr_updaters,
+			div_u64(bench.elapsed_ns, NSEC_PER_MSEC),
+			bench_rate(reads), bench_rate(updates),
+			bench.grace_periods);
+}
+
+/*
+ * Benchmark controller, started instead of the simulation threads.
+ * */
+static int bench_thread(void *data) {
+	const struct cpumask *updater_mask;
+	unsigned long end;
+	u64 start;
+	int err;
+
+	updater_mask = cpumask_empty(&updater_cpus) ? cpu_online_mask :
+		&updater_cpus;
+
+	err = create_bench_threads(bench.readers, bench.nr_readers,
+			bench_reader_thread, "bench_reader",
+			cpumask_empty(&client_cpus) ? cpu_online_mask : &client_cpus);
+	if(!err) {
+		err = create_bench_threads(bench.updaters, bench.nr_updaters,
+				bench_updater_thread, "bench_updater",
+				updater_mask);
+	}
+
+	if(err) {
+		printk(KERN_ERR "HTTP-SERVER: could not start the benchmark\n");
+		stop_bench_threads(bench.readers, bench.nr_readers);
+		stop_bench_threads(bench.updaters, bench.nr_updaters);
+		wait_for_stop();
+		return err;
+	}
+
+	WRITE_ONCE(bench.running, true);
+	call_rcu(&bench.gp_probe, bench_gp_probe);
+	start = ktime_get_ns();
+
+	wake_bench_threads(bench.readers, bench.nr_readers);
+	wake_bench_threads(bench.updaters, bench.nr_updaters);
+
+	end = jiffies + bench_duration*HZ;
+	while(!kthread_should_stop() && time_before(jiffies, end)) {
+		schedule_timeout_interruptible(end - jiffies);
+	}
+
+	WRITE_ONCE(bench.running, false);
+	bench.elapsed_ns = ktime_get_ns() - start;
+
+	stop_bench_threads(bench.readers, bench.nr_readers);
+	stop_bench_threads(bench.updaters, bench.nr_updaters);
+
+	/*
+	 * Let the grace period probe see bench.running cleared.
+	 * */
+	rcu_barrier();
+
+	bench_report();
+	WRITE_ONCE(bench.done, true);
+
+	wait_for_stop();
+
+	return 0;
+}
+
+static int bench_show(struct seq_file *m, void *v) {
+	int i;
+
+	if(!READ_ONCE(bench.done)) {
+		seq_puts(m, "not run\n");
+		return 0;
+	}
+
+	seq_printf(m, "sync: %s\n", sync_ops->name);
+	seq_printf(m, "duration_ns: %llu\n", bench.elapsed_ns);
+	seq_printf(m, "grace_periods: %llu\n", bench.grace_periods);
+
+	for(i = 0; i < bench.nr_readers; i++) {
+		seq_printf(m, "reader %d cpu %d: %llu reads/s\n", i,
+				bench.readers[i].cpu,
+				bench_rate(bench.readers[i].ops));
+	}
+
+	for(i = 0; i < bench.nr_updaters; i++) {
+		seq_printf(m, "updater %d cpu %d: %llu updates/s\n", i,
+				bench.updaters[i].cpu,
+				bench_rate(bench.updaters[i].ops));
+	}
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(bench);
+
+/*
+ * A persistent connection, served by a work item on the CPU it was
+ * accepted on.
+ *
+ * The work item never waits for requests: it reads without blocking,
+ * answers what was received and returns, and the socket callbacks queue
+ * it again when more data arrives. An idle connection hence holds no
+ * kworker, however many are open. The work item is also armed to run
+ * KEEPALIVE_TIMEOUT after the last bytes received, to close the
+ * connection if nothing came meanwhile.
+ *
+ * buf holds the bytes received but not consumed yet, possibly several
+ * pipelined requests, head is the start of the request being parsed by
+ * parser. Up to HTTP_BATCH_MAX complete requests are parsed into
+ * requests[] and answered together, bvecs[] holds their responses.
+ *
+ * A connection closed after a response is lingering until linger_end, see
+ * http_conn_linger().
+ * */
+struct http_request {
+	/*
+	 * Static response, or NULL to serve the resource at key. */
+	struct http_response *error;
+	struct web_data_key key;
+	enum http_disposition disposition;
+
+	/*
+	 * The If-None-Match list, not copied either, if_none_match_len is
+	 * 0 without one. If-Modified-Since, -1 without a valid one.
+	 * */
+	const char *if_none_match;
+	unsigned int if_none_match_len;
+	time64_t if_modified_since;
+
+	/*
+	 * Bit i set if the client accepts enum http_coding i. */
+	unsigned int codings;
+};
+
+struct http_conn {
+	struct delayed_work work;
+	struct list_head list;
+	struct socket *sock;
+	void (*data_ready)(struct sock *sk);
+	void (*state_change)(struct sock *sk);
+	unsigned long last_active;
+	unsigned long linger_end;
+	bool lingering;
+	int id;
+	int len;
+	int head;
+	int nr;
+	struct http_parser parser;
+	struct http_request requests[HTTP_BATCH_MAX];
+	struct bio_vec bvecs[HTTP_BATCH_MAX];
+	char buf[REQUEST_BUFFER_SIZE];
+};
+
+static struct workqueue_struct *http_wq;
+
+/*
+ * Open connections, so that they can be closed on module unload: setting
+ * http_conns_stopping and running their work item closes them. */
+static LIST_HEAD(http_conns);
+static DEFINE_SPINLOCK(http_conns_lock);
+static DECLARE_WAIT_QUEUE_HEAD(http_conns_wait);
+static bool http_conns_stopping;
+
+/*
+ * Receives more bytes into conn->buf, without waiting for them.
+ *
+ * Returns the number of bytes read, 0 if the peer closed the connection,
+ * -EAGAIN if nothing was received yet and a negative error code
+ * otherwise. */
+static inline int http_conn_read(struct http_conn *conn) {
+	struct msghdr msg = { };
+	struct kvec iov;
+	int ret;
+
+	iov.iov_base = conn->buf + conn->len;
+	iov.iov_len = REQUEST_BUFFER_SIZE - conn->len;
+
+	ret = kernel_recvmsg(conn->sock, &msg, &iov, 1, iov.iov_len,
+			MSG_DONTWAIT);
+	if(ret > 0) {
+		conn->len += ret;
+		conn->last_active = jiffies;
+	}
+
+	return ret;
+}
+
+/*
+ * sk_data_ready and sk_state_change of the connections, run in softirq
+ * context: queues the work item of the connection, right away. */
+static void http_conn_data_ready(struct sock *sk) {
+	struct http_conn *conn;
+
+	read_lock_bh(&sk->sk_callback_lock);
+	conn = sk->sk_user_data;
+	if(conn != NULL) {
+		mod_delayed_work_on(conn->id, http_wq, &conn->work, 0);
+	}
+	read_unlock_bh(&sk->sk_callback_lock);
+}
+
+static inline void http_conn_attach(struct http_conn *conn) {
+	struct sock *sk = conn->sock->sk;
+
+	write_lock_bh(&sk->sk_callback_lock);
+	conn->data_ready = sk->sk_data_ready;
+	conn->state_change = sk->sk_state_change;
+	sk->sk_user_data = conn;
+	sk->sk_data_ready = http_conn_data_ready;
+	sk->sk_state_change = http_conn_data_ready;
+	write_unlock_bh(&sk->sk_callback_lock);
+}
+
+/*
+ * Once detached, the socket callbacks do not queue the work item anymore.
+ * */
+static inline void http_conn_detach(struct http_conn *conn) {
+	struct sock *sk = conn->sock->sk;
+
+	write_lock_bh(&sk->sk_callback_lock);
+	sk->sk_user_data = NULL;
+	sk->sk_data_ready = conn->data_ready;
+	sk->sk_state_change = conn->state_change;
+	write_unlock_bh(&sk->sk_callback_lock);
+}
+
+static inline int http_parse_digits(const char *s, int n) {
+	int value = 0;
+
+	for(; n > 0; n--, s++) {
+		if(*s < '0' || *s > '9') {
+			return -1;
+		}
+		value = value * 10 + *s - '0';
+	}
+
+	return value;
+}
+
+/*
+ * Parses an IMF-fixdate, "Sun, 06 Nov 1994 08:49:37 GMT", the format of
+ * Last-Modified. The obsolete formats are not supported, the conditional
+ * is then ignored and the full response sent.
+ *
+ * Returns the date, or -1 if @s is not a valid IMF-fixdate.
+ * */
+static inline time64_t http_parse_date(const char *s, unsigned int len) {
+	int day, mon, year, hour, min, sec;
+
+	if(len != 29 || memcmp(s + 3, ", ", 2) || s[7] != ' ' ||
+			s[11] != ' ' || s[16] != ' ' || s[19] != ':' ||
+			s[22] != ':' || memcmp(s + 25, " GMT", 4)) {
+		return -1;
+	}
+
+	for(mon = 0; mon < ARRAY_SIZE(http_months); mon++) {
+		if(!memcmp(s + 8, http_months[mon], 3)) {
+			break;
+		}
+	}
+
+	day = http_parse_digits(s + 5, 2);
+	year = http_parse_digits(s + 12, 4);
+	hour = http_parse_digits(s + 17, 2);
+	min = http_parse_digits(s + 20, 2);
+	sec = http_parse_digits(s + 23, 2);
+	if(mon == ARRAY_SIZE(http_months) || day < 1 || day > 31 ||
+			year < 1970 || hour < 0 || hour > 23 || min < 0 ||
+			min > 59 || sec < 0 || sec > 60) {
+		return -1;
+	}
+
+	return mktime64(year, mon + 1, day, hour, min, sec);
+}
+
+/*
+ * Whether @params, the parameters of an Accept-Encoding element from its
+ * first ';' on, give it a q-value of 0.
+ * */
+static inline bool http_qvalue_zero(const char *params, unsigned int len) {
+	unsigned int i;
+
+	for(i = 1; i + 2 < len; i++) {
+		if((params[i] != 'q' && params[i] != 'Q') || params[i + 1] != '=' ||
+				(params[i - 1] != ';' && params[i - 1] != ' ' &&
+				 params[i - 1] != '\t')) {
+			continue;
+		}
+
+		if(params[i + 2] != '0') {
+			return false;
+		}
+
+		for(i += 3; i < len && (params[i] == '0' || params[i] == '.'); i++);
+
+		return i == len || params[i] == ' ' || params[i] == '\t' ||
+				params[i] == ';';
+	}
+
+	return false;
+}
+
+/*
+ * Returns the codings accepted by the Accept-Encoding value @list, a
+ * bitmask of enum http_coding. Codings with a q-value of 0 are refused,
+ * other q-values are not ranked, the server's preference applies.
+ * */
+static inline unsigned int http_accepted_codings(const char *list,
+		unsigned int len) {
+	unsigned int i = 0, start, end, name_len, codings = 0, accepted;
+	int coding;
+
+	while(i < len) {
+		if(list[i] == ' ' || list[i] == '\t' || list[i] == ',') {
+			i++;
+			continue;
+		}
+
+		start = i;
+		for(; i < len && list[i] != ',' && list[i] != ';' &&
+				list[i] != ' ' && list[i] != '\t'; i++);
+		name_len = i - start;
+		for(end = i; end < len && list[end] != ','; end++);
+
+		accepted = 0;
+		if(name_len == 1 && list[start] == '*') {
+			accepted = (1U << NR_HTTP_CODINGS) - 1;
+		} else if(name_len == 6 && !strncasecmp(list + start, "x-gzip", 6)) {
+			accepted = 1U << HTTP_CODING_GZIP;
+		}
+
+		for(coding = 0; coding < NR_HTTP_CODINGS; coding++) {
+			if(name_len == strlen(http_coding_names[coding]) &&
+					!strncasecmp(list + start,
+						http_coding_names[coding],
+						name_len)) {
+				accepted = 1U << coding;
+			}
+		}
+
+		if(!http_qvalue_zero(list + i, end - i)) {
+			codings |= accepted;
+		}
+		i = end;
+	}
+
+	return codings;
+}
+
+/*
+ * Fills @req from the request head parsed by @p at @head.
+ *
+ * Only GET is served, routed by server.router. The path is used where it
+ * was received, without its query: "/hello?x=1" is "/hello".
+ *
+ * Request bodies are never read. A request with one is refused, and like
+ * every refused request it closes the connection, so that neither its
+ * body nor anything after it is ever parsed as a request.
+ * */
+static inline void http_route_request(const char *head,
+		const struct http_parser *p, struct http_request *req) {
+	const char *query;
+
+	req->disposition = http_parser_keep_alive(p) ?
+			HTTP_KEEP_ALIVE : HTTP_CLOSE;
+
+	if(p->transfer_encoding) {
+		req->error = &bad_request_response;
+	} else if(p->content_length > 0) {
+		req->error = &too_large_response;
+	} else if(p->method_len != 3 || memcmp(head, "GET", 3)) {
+		req->error = &not_allowed_response;
+	} else {
+		req->error = NULL;
+	}
+
+	if(req->error != NULL) {
+		req->disposition = HTTP_CLOSE;
+		return;
+	}
+
+	req->key.path = head + p->path_off;
+	query = memchr(req->key.path, '?', p->path_len);
+	req->key.len = query ? query - req->key.path : p->path_len;
+
+	req->if_none_match = head + p->if_none_match.off;
+	req->if_none_match_len = p->if_none_match.len;
+	req->if_modified_since = -1;
+	if(p->if_modified_since.len > 0) {
+		req->if_modified_since = http_parse_date(
+				head + p->if_modified_since.off,
+				p->if_modified_since.len);
+	}
+
+	req->codings = http_accepted_codings(head + p->accept_encoding.off,
+			p->accept_encoding.len);
+}
+
+/*
+ * Whether the entity tag list @list, the value of If-None-Match, has
+ * @etag. Comparison is weak, as required for If-None-Match.
+ * */
+static inline bool http_etag_match(const char *list, unsigned int len,
+		const char *etag, unsigned int etag_len) {
+	unsigned int i = 0, start;
+
+	if(len == 1 && list[0] == '*') {
+		return true;
+	}
+
+	while(i < len) {
+		if(list[i] == ' ' || list[i] == '\t' || list[i] == ',') {
+			i++;
+			continue;
+		}
+
+		if(len - i >= 2 && !memcmp(list + i, "W/", 2)) {
+			i += 2;
+		}
 
-static inline int initialize_time(void) {
-	struct time *time;
+		if(i == len || list[i] != '"') {
+			return false;
+		}
 
-	time = kmalloc(sizeof(*time), GFP_KERNEL);
+		start = i;
+		for(i++; i < len && list[i] != '"'; i++);
+		if(i == len) {
+			return false;
+		}
+		i++;
 
-	if(time == NULL) {
-		return -ENOMEM;
+		if(i - start == etag_len &&
+				!memcmp(list + start, etag, etag_len)) {
+			return true;
+		}
 	}
 
-	time->time = 0;
+	return false;
+}
 
-	rcu_assign_pointer(server.update_timestamp, time);
+/*
+ * Whether the client of @req already has the representation of @web_data
+ * in @coding, the one it would be served. If-Modified-Since is only looked
+ * at without If-None-Match, and dates in the future are not valid.
+ * */
+static inline bool http_not_modified(const struct http_request *req,
+		const struct web_data *web_data, enum http_coding coding) {
+	const struct http_representation *repr = &web_data->render.repr[coding];
+
+	if(req->if_none_match_len > 0) {
+		return http_etag_match(req->if_none_match,
+				req->if_none_match_len, repr->etag,
+				repr->etag_len);
+	}
 
-	return 0;
+	return req->if_modified_since >= web_data->render.modified &&
+			req->if_modified_since <= ktime_get_real_seconds();
 }
 
-static inline int initialize_state(void) {
-	struct state *state;
-
-	state = kmalloc(sizeof(*state), GFP_KERNEL);
+/*
+ * Parses the requests received since the last call into conn->requests,
+ * stopping after a request closing the connection. conn->head is advanced
+ * past the complete requests.
+ * */
+static inline void http_parse_batch(struct http_conn *conn) {
+	struct http_request *req;
+	int ret;
+
+	conn->nr = 0;
+	while(conn->nr < HTTP_BATCH_MAX) {
+		ret = http_parse(&conn->parser, conn->buf + conn->head,
+				conn->len - conn->head);
+		if(ret == HTTP_PARSE_AGAIN) {
+			break;
+		}
 
-	if(state == NULL) {
-		return -ENOMEM;
-	}
+		req = &conn->requests[conn->nr++];
+		if(ret == HTTP_PARSE_ERROR) {
+			req->error = &bad_request_response;
+			req->disposition = HTTP_CLOSE;
+			break;
+		}
 
-	state->is_in_recovery = false;
-	rcu_head_init(&state->rcu);
+		http_route_request(conn->buf + conn->head, &conn->parser, req);
+		conn->head += conn->parser.off;
+		http_parser_init(&conn->parser);
 
-	rcu_assign_pointer(server.state, state);
+		/*
+		 * The requests pipelined after it are not answered. The batch
+		 * up to it is, and the rest is discarded by the lingering
+		 * close, which does not reset the connection under the
+		 * responses, see http_conn_shutdown(). */
+		if(req->disposition == HTTP_CLOSE) {
+			break;
+		}
+	}
 
-	return 0;
+	/*
+	 * A request which does not fit in the buffer. */
+	if(conn->nr == 0 && conn->head == 0 &&
+			conn->len == REQUEST_BUFFER_SIZE) {
+		conn->requests[0].error = &bad_request_response;
+		conn->requests[0].disposition = HTTP_CLOSE;
+		conn->nr = 1;
+	}
 }
 
-static inline int initialize_web_data(void) {
+/*
+ * Answers the parsed batch.
+ *
+ * All the responses are picked in a single read section, and the batch is
+ * then handed to the socket in one call without copying. The socket write
+ * may sleep on socket buffers, so the responses are kept alive by an
+ * http_srcu read section around both instead of RCU, the socket takes its
+ * own page references for what it queues.
+ *
+ * The read section holds back the reclamation of every replaced version,
+ * and through the reclamation backlog the updaters, so a client which
+ * does not take the batch within SOCKET_TIMEOUT in total fails it with
+ * -ETIMEDOUT and gets disconnected.
+ *
+ * Requests are routed with the routing table current at the start of the
+ * section, and the whole batch is answered from one generation of
+ * server.content, so that pipelined requests never see a partially
+ * published set of changes.
+ * */
+static inline int http_respond_batch(struct http_conn *conn) {
+	struct msghdr msg = { .msg_flags = MSG_SPLICE_PAGES | MSG_NOSIGNAL };
+	const struct web_data_key *key, *prev;
+	const struct content_set *content;
+	const struct http_router *router;
+	const struct http_route *route;
+	struct http_response *response;
+	struct http_request *req;
 	struct web_data *web_data;
+	struct sync_read_ctx ctx;
+	enum http_coding coding;
+	unsigned long deadline;
+	long timeout;
+	size_t len;
+	bool recovery, retry;
+	u64 start;
+	int i, idx, ret = 0;
+
+	idx = srcu_read_lock(&http_srcu);
+
+	do {
+		len = 0;
+
+		start = local_clock();
+		sync_ops->read_lock(&ctx);
+		rcu_read_lock();
 
-	web_data = kmalloc(sizeof(*web_data), GFP_KERNEL);
+		recovery = static_branch_unlikely(&recovery_mode);
+		router = rcu_dereference(server.router);
+		content = rcu_dereference(server.content);
+		web_data = NULL;
+		prev = NULL;
+
+		for(i = 0; i < conn->nr; i++) {
+			req = &conn->requests[i];
+			route = NULL;
+
+			if(req->error == NULL && !recovery) {
+				route = http_route_lookup(router, &req->key);
+			}
+
+			if(req->error != NULL) {
+				response = req->error;
+			} else if(recovery) {
+				response = format_data_carefully(conn->id);
+			} else if(route == NULL) {
+				response = &not_found_response;
+			} else if(route->handler == HTTP_HANDLER_DENY) {
+				response = &forbidden_response;
+			} else {
+				key = route->handler == HTTP_HANDLER_DOCUMENT ?
+						&route->target : &req->key;
+				if(prev == NULL || !web_data_key_equal(prev, key)) {
+					web_data = lookup_web_data(content, key);
+					prev = key;
+				}
+
+				if(web_data == NULL) {
+					response = &not_found_response;
+				} else {
+					coding = http_select_coding(web_data,
+							req->codings);
+					response = format_data(conn->id, web_data,
+							coding,
+							http_not_modified(req,
+								web_data, coding));
+				}
+			}
+
+			bvec_set_page(&conn->bvecs[i], response->page,
+					response->len[req->disposition],
+					response->off[req->disposition]);
+			len += response->len[req->disposition];
+		}
 
-	if(web_data == NULL) {
-		return -ENOMEM;
-	}
+		rcu_read_unlock();
+		retry = sync_ops->read_unlock(&ctx);
+		http_stats_read_section(start);
+	} while(retry);
+
+	iov_iter_bvec(&msg.msg_iter, ITER_SOURCE, conn->bvecs, conn->nr, len);
+	deadline = jiffies + SOCKET_TIMEOUT*HZ;
+	while(iov_iter_count(&msg.msg_iter) > 0) {
+		timeout = (long)(deadline - jiffies);
+		if(timeout <= 0) {
+			ret = -ETIMEDOUT;
+			break;
+		}
 
-	web_data->message = 0;
-	rcu_head_init(&web_data->rcu);
+		conn->sock->sk->sk_sndtimeo = timeout;
+		ret = sock_sendmsg(conn->sock, &msg);
+		if(ret <= 0) {
+			ret = ret ? ret : -EPIPE;
+			break;
+		}
+		ret = 0;
+	}
 
-	rcu_assign_pointer(server.web_data, web_data);
+	srcu_read_unlock(&http_srcu, idx);
 
-	return 0;
+	return ret;
 }
 
-static inline int initialize_server(void) {
-	int err;
-
-	INIT_LIST_HEAD(&server.clients);
-
-	err = initialize_web_data();
-	if(err) goto err;
-
-	err = initialize_state();
-	if(err) goto err;
+/*
+ * Closes @conn from its own work item, which must not run again: no
+ * callback nor http_close_connections() can queue it anymore, and an
+ * instance queued before is cancelled.
+ * */
+static inline void http_conn_close(struct http_conn *conn) {
+	http_conn_detach(conn);
 
-	err = initialize_time();
-	if(err) goto err;
+	spin_lock(&http_conns_lock);
+	list_del(&conn->list);
+	if(list_empty(&http_conns)) {
+		wake_up_all(&http_conns_wait);
+	}
+	spin_unlock(&http_conns_lock);
 
-	return 0;
+	cancel_delayed_work(&conn->work);
 
-err:
-	return err;
+	kernel_sock_shutdown(conn->sock, SHUT_RDWR);
+	sock_release(conn->sock);
+	kfree(conn);
 }
 
 /*
- * This probably means we are in recovery, hence server.web_data may be in an
- * inconsistent state hence cannot dereference the data. */
-static inline void send_data_carefully(int id) {
-	printk(KERN_INFO "Data:\nid: %d\nStatus Code: 438\nMode: Recovery\n", id);
+ * Closes @conn gracefully once its last response was handed to the socket.
+ *
+ * Releasing a socket with unread data resets the connection, and the
+ * peer may then drop the responses it did not read yet: the body of a
+ * refused request or the requests pipelined after a "Connection: close"
+ * would cost it the very responses explaining the close. Instead, the
+ * sending side is shut down after the responses, and what the peer still
+ * sends is discarded until it closes its side too, for KEEPALIVE_TIMEOUT
+ * at most.
+ * */
+static inline void http_conn_shutdown(struct http_conn *conn) {
+	kernel_sock_shutdown(conn->sock, SHUT_WR);
+	conn->linger_end = jiffies + KEEPALIVE_TIMEOUT*HZ;
+	conn->lingering = true;
 }
 
 /*
- * Conditions are normal, and we are being executed in a read section
- * we can dereference the data and send it. */
-static inline void send_data(int id) {
-	struct web_data *web_data = rcu_dereference_check(server.web_data,
-							rcu_read_lock_held());
+ * Discards what was received on a lingering @conn. Returns true once it
+ * can be released, false if the work item was armed to wait for more.
+ * */
+static inline bool http_conn_linger(struct http_conn *conn) {
+	int ret;
+
+	do {
+		conn->len = 0;
+		ret = http_conn_read(conn);
+	} while(ret > 0 && time_before(jiffies, conn->linger_end));
 
-	printk(KERN_INFO "Data:\nid: %d\nStatus Code: 200\nMode: Normal\nData: %d\n",
-			id, web_data->message);
+	if(ret != -EAGAIN || time_after_eq(jiffies, conn->linger_end)) {
+		return true;
+	}
+
+	queue_delayed_work_on(conn->id, http_wq, &conn->work,
+			conn->linger_end - jiffies);
+	return false;
 }
 
 /*
- * Client thread */
-static inline int setup_client(void *data) {
-	int timeout = *(int*)data;
-	bool is_in_recovery;
-
-	while(!kthread_should_stop()) {
-		rcu_read_lock();
-		is_in_recovery = rcu_dereference(server.state)->is_in_recovery;
-		if(is_in_recovery) {
-			send_data_carefully(timeout/TIMEOUT_MULTIPLIER);
-		} else {
-			send_data(timeout/TIMEOUT_MULTIPLIER);
+ * Answers the requests received so far, at most HTTP_CONN_BUDGET batches
+ * before yielding the CPU to the other connections, and returns once the
+ * socket has nothing more to read.
+ * */
+static void http_conn_work(struct work_struct *work) {
+	struct http_conn *conn = container_of(to_delayed_work(work),
+			struct http_conn, work);
+	unsigned long idle_end;
+	int batches = 0, ret;
+
+	while(!READ_ONCE(http_conns_stopping)) {
+		if(conn->lingering) {
+			if(!http_conn_linger(conn)) {
+				return;
+			}
+			break;
 		}
-		rcu_read_unlock();
-	
-		msleep_interruptible(timeout*1000);
-	}
 
-	return 0;
-}
+		http_parse_batch(conn);
+
+		if(conn->nr == 0) {
+			ret = http_conn_read(conn);
+			if(ret > 0) {
+				continue;
+			}
+
+			idle_end = conn->last_active + KEEPALIVE_TIMEOUT*HZ;
+			if(ret != -EAGAIN || time_after_eq(jiffies, idle_end)) {
+				break;
+			}
+
+			/*
+			 * Does not override an instance queued by the socket
+			 * callbacks since the read. */
+			queue_delayed_work_on(conn->id, http_wq, &conn->work,
+					idle_end - jiffies);
+			return;
+		}
 
-static inline void set_mode_recovery(bool flag) {
-	struct state *current_state;
+		if(http_respond_batch(conn)) {
+			break;
+		}
 
-	spin_lock(&state_mutex);
-	current_state = rcu_dereference_protected(server.state,
-			lockdep_is_held(&state_mutex));
+		if(conn->requests[conn->nr - 1].disposition == HTTP_CLOSE) {
+			http_conn_shutdown(conn);
+			continue;
+		}
 
-	if(current_state->is_in_recovery == flag) {
-		spin_unlock(&state_mutex);
-		return;
+		/*
+		 * Only the request being parsed is kept, its offsets are
+		 * relative to its start. */
+		conn->len -= conn->head;
+		memmove(conn->buf, conn->buf + conn->head, conn->len);
+		conn->head = 0;
+
+		if(++batches == HTTP_CONN_BUDGET) {
+			queue_delayed_work_on(conn->id, http_wq, &conn->work, 0);
+			return;
+		}
 	}
 
-	current_state->is_in_recovery = flag;
-	spin_unlock(&state_mutex);
+	http_conn_close(conn);
 }
 
-static inline int recover_server(void) {
-	struct web_data *web_data;
-	struct web_data *new_web_data;
-	struct time *update_timestamp;
+/*
+ * Worker thread: accepts connections on the listener of its CPU and hands
+ * them to work items on the same CPU, see struct http_conn.
+ *
+ * The listener has a receive timeout so that the worker periodically gets
+ * to check kthread_should_stop(). */
+static inline int http_worker_thread(void *data) {
+	struct http_worker *worker = data;
+	struct http_conn *conn;
+	struct socket *sock;
+	int err;
 
-	/*
-	 * No concurrent readers hence we can directly update the data
-	 * */
-	spin_lock(&server_mutex);
-	web_data = rcu_dereference_protected(server.web_data,
-			lockdep_is_held(&server_mutex));
+	while(!kthread_should_stop()) {
+		err = kernel_accept(worker->listener, &sock, 0);
+		if(err == -EAGAIN) {
+			continue;
+		} else if(err) {
+			/*
+			 * The listener has been shut down (module unload) or
+			 * accept failed transiently, back off either way.
+			 * */
+			schedule_timeout_interruptible(HZ/10);
+			continue;
+		}
+
+		conn = kmalloc(sizeof(*conn), GFP_KERNEL);
+		if(conn == NULL) {
+			sock_release(sock);
+			continue;
+		}
 
-	new_web_data = kmalloc(sizeof(*new_web_data), GFP_KERNEL);
+		INIT_DELAYED_WORK(&conn->work, http_conn_work);
+		conn->sock = sock;
+		conn->id = worker->id;
+		conn->last_active = jiffies;
+		conn->lingering = false;
+		conn->len = 0;
+		conn->head = 0;
+		http_parser_init(&conn->parser);
 
-	if(new_web_data == NULL) {
-		spin_unlock(&server_mutex);
-		return -ENOMEM;
+		spin_lock(&http_conns_lock);
+		list_add(&conn->list, &http_conns);
+		spin_unlock(&http_conns_lock);
+
+		/*
+		 * For the bytes received before the callbacks were set. */
+		http_conn_attach(conn);
+		queue_delayed_work_on(worker->id, http_wq, &conn->work, 0);
 	}
 
-	new_web_data->message = (2*(web_data->message));
-	rcu_head_init(&new_web_data->rcu);
+	return 0;
+}
 
-	rcu_assign_pointer(server.web_data, new_web_data);
+/*
+ * Listening sockets, one per worker CPU.
+ *
+ * They all bind the same address with SO_REUSEPORT, so there is no shared
+ * accept queue nor lock. Each one has sk_incoming_cpu set to its CPU, which
+ * makes the reuseport group hand a connection to the listener of the CPU
+ * the SYN was received on, where its worker is bound. Connections are
+ * hence accepted, parsed and answered without leaving that CPU.
+ * */
+static DEFINE_PER_CPU(struct socket *, http_listener);
 
-	/*
-	 * Note: we cannot use the following assignment since,
-	 * below we need to use web_data->message to update the timestamp.
-	 *
-	 * If we'd used the following assignment and later used
-	 * update_timestamp->time = web_data->message+1
-	 * we might have gotten inconsistent data due to CPU/compiler
-	 * reordering.
-	 *
-	 * PS: creating a simple variable would've solved this problem but RCU
-	 * can also handle this!
-	 * */
-	// web_data->message = (1<<web_data->message);
+/*
+ * CPUs running a listener and a worker. */
+static inline const struct cpumask *http_worker_cpus(void) {
+	return cpumask_empty(&worker_cpus) ? cpu_online_mask : &worker_cpus;
+}
 
-	/*
-	 * This is a simple example, but sadly recovering a failed system
-	 * doesn't take a few nanoseconds.
-	 * */
-	msleep_interruptible(TIME_TO_RECOVER*1000);
+static inline int create_listener(int cpu, struct socket **res) {
+	struct sockaddr_in addr = {
+		.sin_family = AF_INET,
+		.sin_port = htons(port),
+		.sin_addr.s_addr = htonl(listen_any ? INADDR_ANY : INADDR_LOOPBACK),
+	};
+	struct socket *sock;
+	int err;
 
-	update_timestamp = rcu_dereference_protected(server.update_timestamp,
-			lockdep_is_held(&server_mutex));
-	update_timestamp->time = web_data->message ^ update_timestamp->time;
+	err = sock_create_kern(&init_net, AF_INET, SOCK_STREAM, IPPROTO_TCP,
+			&sock);
+	if(err) {
+		return err;
+	}
 
-	spin_unlock(&server_mutex);
+	sock_set_reuseaddr(sock->sk);
+	sock_set_reuseport(sock->sk);
+	WRITE_ONCE(sock->sk->sk_incoming_cpu, cpu);
+	sock->sk->sk_rcvtimeo = SOCKET_TIMEOUT*HZ;
+
+	err = kernel_bind(sock, (struct sockaddr *)&addr, sizeof(addr));
+	if(err) goto err;
 
-	kfree_rcu(web_data, rcu);
+	err = kernel_listen(sock, LISTEN_BACKLOG);
+	if(err) goto err;
+
+	*res = sock;
 
 	return 0;
+
+err:
+	sock_release(sock);
+	return err;
 }
 
 /*
- * Thread created for recovering the server.
- *
- * The recovery of the system takes a lot of time to complete,
- * during which server.web_data may remain in an inconsistent state,
- * i.e., sending the data from server.web_data may be disastrous.
- *
- * To overcome this we first set the state to recovery, so that,
- * the server doesn't send the data from server.web_data
- * (send_data_carefully()),
- * post which we can work on fixing the problem. During this time, the system
- * will never read from server.web_data (inconsistent data).
+ * Wakes up the workers blocked in kernel_accept(), must be called before
+ * clean_up_threads().
  * */
-static inline int recover_system_thread(void *data) {
-	while(!kthread_should_stop()) {
-		msleep_interruptible(TIME_BEFORE_RECOVERY*1000);
+static inline void shutdown_listener(void) {
+	struct socket *sock;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		sock = per_cpu(http_listener, cpu);
+		if(sock != NULL) {
+			kernel_sock_shutdown(sock, SHUT_RDWR);
+		}
+	}
+}
 
-		printk(KERN_INFO "HTTP-SERVER: [FATAL] Some error occured. Initializing recovery procedure.\n");
-		set_mode_recovery(true);
+static inline void release_listener(void) {
+	struct socket **sock;
+	int cpu;
 
-		/*
-		 * This synchronize_rcu() is important before modifying server.web_data
-		 *
-		 * This instructs all the on going reader sections to exit.
-		 *
-		 * If this were not the case, the system would continue to access and
-		 * send data from server.web_data which now is in inconsistent state.
-		 *
-		 * But now, after this statement is executed, all the readers will see
-		 * the updated state (recovery) and none of them would send inconsistent
-		 * data.
-		 *
-		 * See setup_client()
-		 * */
-		synchronize_rcu();
+	for_each_possible_cpu(cpu) {
+		sock = per_cpu_ptr(&http_listener, cpu);
+		if(*sock != NULL) {
+			sock_release(*sock);
+			*sock = NULL;
+		}
+	}
+}
 
-		printk(KERN_INFO "HTTP-SERVER: Starting server secovery\n");
+static inline int initialize_listener(void) {
+	int cpu, err;
 
-		/*
-		 * Fix the corrupt data.
-		 * */
-		recover_server();
+	for_each_cpu_and(cpu, http_worker_cpus(), cpu_online_mask) {
+		err = create_listener(cpu, per_cpu_ptr(&http_listener, cpu));
+		if(err) {
+			release_listener();
+			return err;
+		}
+	}
 
-		printk(KERN_INFO "HTTP-SERVER: Server successfully recovered\n");
+	return 0;
+}
 
-		/*
-		 * Recovery is done. Readers can now access server.web_data.
-		 * */
-		set_mode_recovery(false);
+static inline int initialize_connections(void) {
+	WRITE_ONCE(http_conns_stopping, false);
 
-		set_current_state(TASK_INTERRUPTIBLE);
-		schedule();
+	http_wq = alloc_workqueue("http_conn", 0, 0);
+	if(http_wq == NULL) {
+		return -ENOMEM;
 	}
 
 	return 0;
 }
 
-/*
- * Code run by updater threads.
- * Protection using RCU primitives.
- * */
-static inline int updater_thread(void *data) {
-	struct web_data *web_data;
-	struct web_data *new_web_data;
+static inline bool http_conns_closed(void) {
+	bool ret;
 
-	while(!kthread_should_stop()) {
-		rcu_read_lock();
-		if(rcu_dereference(server.state)->is_in_recovery) {
-			rcu_read_unlock();
-			goto try_again;
-		}
+	spin_lock(&http_conns_lock);
+	ret = list_empty(&http_conns);
+	spin_unlock(&http_conns_lock);
 
-		spin_lock(&server_mutex);
-		web_data = rcu_dereference_protected(server.web_data,
-				lockdep_is_held(&server_mutex));
+	return ret;
+}
 
-		new_web_data = kmalloc(sizeof(*new_web_data), GFP_KERNEL);
+/*
+ * Closes the open connections, idle ones included, and waits for them.
+ * */
+static inline void http_close_connections(void) {
+	struct http_conn *conn;
 
-		if(new_web_data == NULL) {
-			spin_unlock(&server_mutex);
-			rcu_read_unlock();
-			goto try_again;
-		}
+	WRITE_ONCE(http_conns_stopping, true);
 
-		new_web_data->message = (web_data->message)+3;
-		rcu_head_init(&new_web_data->rcu);
-		rcu_assign_pointer(server.web_data, new_web_data);
-		spin_unlock(&server_mutex);
+	spin_lock(&http_conns_lock);
+	list_for_each_entry(conn, &http_conns, list) {
+		mod_delayed_work_on(conn->id, http_wq, &conn->work, 0);
+	}
+	spin_unlock(&http_conns_lock);
 
-		printk(KERN_INFO "Updated value to %d", new_web_data->message);
-		kfree_rcu(web_data, rcu);
-		rcu_read_unlock();
+	wait_event(http_conns_wait, http_conns_closed());
+}
 
-	/*while(!kthread_should_stop()) {
-		set_current_state(TASK_INTERRUPTIBLE);
-		schedule();
-	}*/
-try_again:
-		msleep_interruptible(UPDATE_FREQUENCY*1000);
+/*
+ * Must be called after the workers have been stopped.
+ * */
+static inline void clean_up_connections(void) {
+	if(http_wq != NULL) {
+		http_close_connections();
+		destroy_workqueue(http_wq);
+		http_wq = NULL;
 	}
+}
 
-	return 0;
+/*
+ * Restricts a thread which has not been woken up yet to @cpus, an empty
+ * mask leaves it to the scheduler. */
+static inline void bind_thread(struct task_struct *task,
+		const struct cpumask *cpus) {
+	if(!cpumask_empty(cpus)) {
+		set_cpus_allowed_ptr(task, cpus);
+	}
 }
 
 static inline void clean_up_threads(void) {
@@ -336,6 +3010,7 @@ static inline void clean_up_threads(void) {
 		if(client->task != NULL) {
 			kthread_stop(client->task);
 		}
+		kfree(client->data);
 		kfree(client);
 	}
 }
@@ -346,33 +3021,34 @@ static inline void clean_up_threads(void) {
  * */
 static inline int initialize_clients(int n) {
 	int i, *timeout;
-	char *name;
 	struct client *client;
 
-	name = kmalloc(8, GFP_KERNEL);
-	if(name == NULL) return -ENOMEM;
-
 	for(i = 0; i < n; i++) {
 		client = kmalloc(sizeof(*client), GFP_KERNEL);
+		timeout = kmalloc(sizeof(int), GFP_KERNEL);
 
-		if(client == NULL) {
+		if(client == NULL || timeout == NULL) {
+			kfree(client);
+			kfree(timeout);
 			clean_up_threads();
 			return -ENOMEM;
 		}
 
-		sprintf(name, "thread%d", i);
-
-		timeout = kmalloc(sizeof(int), GFP_ATOMIC);
-		*timeout = (i+1) * TIMEOUT_MULTIPLIER;
+		*timeout = (i+1) * timeout_multiplier;
 
 		client->id = i+1;
-		client->task = kthread_create(setup_client, (void*)timeout, name);
+		client->data = timeout;
+		client->task = kthread_create(setup_client, (void*)timeout,
+				"thread%d", i);
 
-		if(client->task == NULL) {
+		if(IS_ERR(client->task)) {
+			kfree(client);
+			kfree(timeout);
 			clean_up_threads();
 			return -ENOMEM;
 		}
 
+		bind_thread(client->task, &client_cpus);
 		list_add(&client->clients_list, &server.clients);
 	}
 
@@ -381,11 +3057,6 @@ static inline int initialize_clients(int n) {
 
 static inline int initialize_crash(void) {
 	struct client *client;
-	char *name;
-
-	name = kmalloc(128, GFP_ATOMIC);
-	if(name ==  NULL) return -ENOMEM;
-	sprintf(name, "recovery_thread_rcu");
 
 	client = kmalloc(sizeof(*client), GFP_KERNEL);
 
@@ -394,9 +3065,12 @@ static inline int initialize_crash(void) {
 	}
 
 	client->id = 7234;
-	client->task = kthread_create(recover_system_thread, NULL, name);
+	client->data = NULL;
+	client->task = kthread_create(recover_system_thread, NULL,
+			"recovery_thread_rcu");
 
-	if(client->task == NULL) {
+	if(IS_ERR(client->task)) {
+		kfree(client);
 		goto no_mem;
 	}
 
@@ -419,12 +3093,16 @@ static inline int initialize_updater(void) {
 	}
 
 	client->id = 5243;
+	client->data = NULL;
 	client->task = kthread_create(updater_thread, NULL, "updater_http");
 
-	if(client->task == NULL) {
+	if(IS_ERR(client->task)) {
+		kfree(client);
 		goto no_mem;
 	}
 
+	bind_thread(client->task, &updater_cpus);
+
 	list_add(&client->clients_list, &server.clients);
 
 	return 0;
@@ -434,32 +3112,165 @@ no_mem:
 	return -ENOMEM;
 }
 
-static int __init http_server_rcu_init(void) {
+/*
+ * Initializes one HTTP worker per listener, bound to the listener's CPU.
+ * */
+static inline int initialize_workers(void) {
+	struct http_worker *worker;
 	struct client *client;
+	int cpu;
 
-	if(initialize_server()) {
-		return -EFAULT;
+	for_each_possible_cpu(cpu) {
+		if(per_cpu(http_listener, cpu) == NULL) {
+			continue;
+		}
+
+		client = kmalloc(sizeof(*client), GFP_KERNEL);
+		worker = kmalloc(sizeof(*worker), GFP_KERNEL);
+
+		if(client == NULL || worker == NULL) {
+			kfree(client);
+			kfree(worker);
+			goto no_mem;
+		}
+
+		worker->id = cpu;
+		worker->listener = per_cpu(http_listener, cpu);
+
+		client->id = cpu+1;
+		client->data = worker;
+		client->task = kthread_create(http_worker_thread, worker,
+				"http_worker/%d", cpu);
+
+		if(IS_ERR(client->task)) {
+			kfree(client);
+			kfree(worker);
+			goto no_mem;
+		}
+
+		kthread_bind(client->task, cpu);
+
+		list_add(&client->clients_list, &server.clients);
 	}
 
-	if(initialize_clients(NUM_CLIENTS)) {
-		return -EFAULT;
+	return 0;
+
+no_mem:
+	clean_up_threads();
+	return -ENOMEM;
+}
+
+static inline int initialize_bench(void) {
+	struct client *client;
+
+	bench.nr_readers = bench_readers ? bench_readers : num_online_cpus();
+	bench.nr_updaters = bench_updaters;
+
+	bench.readers = kcalloc(bench.nr_readers, sizeof(*bench.readers),
+			GFP_KERNEL);
+	bench.updaters = kcalloc(bench.nr_updaters, sizeof(*bench.updaters),
+			GFP_KERNEL);
+	client = kmalloc(sizeof(*client), GFP_KERNEL);
+
+	if(bench.readers == NULL || bench.updaters == NULL || client == NULL) {
+		kfree(client);
+		return -ENOMEM;
+	}
+
+	client->id = 9001;
+	client->data = NULL;
+	client->task = kthread_create(bench_thread, NULL, "bench_http");
+
+	if(IS_ERR(client->task)) {
+		kfree(client);
+		return -ENOMEM;
+	}
+
+	list_add(&client->clients_list, &server.clients);
+
+	debugfs_create_file("bench", 0444, debugfs_dir, NULL, &bench_fops);
+
+	return 0;
+}
+
+/*
+ * Must be called after clean_up_threads().
+ * */
+static inline void clean_up_bench(void) {
+	kfree(bench.readers);
+	kfree(bench.updaters);
+	bench.readers = NULL;
+	bench.updaters = NULL;
+}
+
+/*
+ * Threads of the normal mode: simulated clients, failure/recovery,
+ * updater and the HTTP listener.
+ * */
+static inline int initialize_simulation(void) {
+	if(initialize_clients(num_clients)) {
+		return -ENOMEM;
 	}
 
 	if(initialize_crash()) {
-		return -EFAULT;
+		return -ENOMEM;
 	}
 
 	if(initialize_updater()) {
+		return -ENOMEM;
+	}
+
+	if(initialize_listener()) {
+		clean_up_threads();
 		return -EFAULT;
 	}
 
+	if(initialize_connections()) {
+		release_listener();
+		clean_up_threads();
+		return -ENOMEM;
+	}
+
+	if(initialize_workers()) {
+		clean_up_connections();
+		release_listener();
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+
+static int __init http_server_rcu_init(void) {
+	struct client *client;
+	int err;
+
+	if(initialize_sync()) {
+		return -EINVAL;
+	}
+
+	if(initialize_server()) {
+		goto err;
+	}
+
+	initialize_stats();
+	initialize_publishing();
+
+	if(bench_duration) {
+		err = initialize_bench();
+	} else {
+		err = initialize_simulation();
+	}
+
+	if(err) {
+		goto err;
+	}
+
 	printk(KERN_ERR "Initializing server!");
 	printk(KERN_ERR "Initial Server Status\nMessage: %d\nRecovery: %d\nTimestamp: %d\n",
-			server.web_data->message,
+			read_web_data()->message,
 			server.state->is_in_recovery,
 			server.update_timestamp->time);
 
-
 	list_for_each_entry(client, &server.clients, clients_list) {
 		if(client->task) {
 			wake_up_process(client->task);
@@ -467,11 +3278,27 @@ static int __init http_server_rcu_init(void) {
 	}
 
 	return 0;
+
+err:
+	clean_up_bench();
+	clean_up_stats();
+	clean_up_router();
+	clean_up_web_data_cache();
+	clean_up_compression();
+	return -EFAULT;
 }
 
 static void __exit http_server_rcu_exit(void) {
 	printk(KERN_ERR "Destroying server!");
+	shutdown_listener();
 	clean_up_threads();
+	clean_up_connections();
+	release_listener();
+	clean_up_bench();
+	clean_up_stats();
+	clean_up_router();
+	clean_up_web_data_cache();
+	clean_up_compression();
 	printk(KERN_ERR "Cleanup done!");
 }
 
@@ -0,0 +1,90 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM http_rcu
+
+#if !defined(_HTTP_SERVER_RCU_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _HTTP_SERVER_RCU_TRACE_H
+
+#include <linux/tracepoint.h>
+
+/*
+ * A response was built from a version in server.content in normal mode.
+ * @id - client or worker id
+ * @status - 200, or 304 for a conditional GET of an unchanged version
+ * @message - web_data->message of the version, 0 except for "/"
+ * */
+TRACE_EVENT(response_sent,
+
+	TP_PROTO(int id, int status, int message),
+
+	TP_ARGS(id, status, message),
+
+	TP_STRUCT__entry(
+		__field(int, id)
+		__field(int, status)
+		__field(int, message)
+	),
+
+	TP_fast_assign(
+		__entry->id = id;
+		__entry->status = status;
+		__entry->message = message;
+	),
+
+	TP_printk("id=%d status=%d message=%d",
+		__entry->id, __entry->status, __entry->message)
+);
+
+/*
+ * A 438 response was built since the server was in recovery mode.
+ * @id - client or worker id
+ * */
+TRACE_EVENT(recovery_response,
+
+	TP_PROTO(int id),
+
+	TP_ARGS(id),
+
+	TP_STRUCT__entry(
+		__field(int, id)
+	),
+
+	TP_fast_assign(
+		__entry->id = id;
+	),
+
+	TP_printk("id=%d status=438", __entry->id)
+);
+
+/*
+ * publish_updates() published a new version of "/" in server.content,
+ * for the updater or a benchmark updater.
+ * @old_message - message of the version being replaced
+ * @message - message of the new version
+ * */
+TRACE_EVENT(web_data_updated,
+
+	TP_PROTO(int old_message, int message),
+
+	TP_ARGS(old_message, message),
+
+	TP_STRUCT__entry(
+		__field(int, old_message)
+		__field(int, message)
+	),
+
+	TP_fast_assign(
+		__entry->old_message = old_message;
+		__entry->message = message;
+	),
+
+	TP_printk("old_message=%d message=%d",
+		__entry->old_message, __entry->message)
+);
+
+#endif /* _HTTP_SERVER_RCU_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE http_server_rcu_trace
+#include <trace/define_trace.h>
@@ -0,0 +1,378 @@
+/*
+ * Tests of the request head parser, http_parser.h.
+ *
+ * Every request is fed whole, then in fragments of every size down to one
+ * byte at a time, and must give the same result each time, as the module
+ * receives requests however the network splits them.
+ * */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../http_parser.h"
+
+static int failures;
+static int checks;
+
+#define CHECK(cond) do { \
+	checks++; \
+	if(!(cond)) { \
+		failures++; \
+		fprintf(stderr, "%s:%d: %s: CHECK(%s) failed\n", __FILE__, \
+				__LINE__, name, #cond); \
+	} \
+} while(0)
+
+/*
+ * Parses @req by fragments of @chunk bytes, resuming where the previous
+ * call stopped as http_conn_work() does. */
+static enum http_parse_status parse_chunked(struct http_parser *p,
+		const char *req, unsigned int len, unsigned int chunk) {
+	enum http_parse_status ret = HTTP_PARSE_AGAIN;
+	unsigned int avail = 0;
+
+	http_parser_init(p);
+
+	while(ret == HTTP_PARSE_AGAIN && avail < len) {
+		avail = avail + chunk < len ? avail + chunk : len;
+		ret = http_parse(p, req, avail);
+	}
+
+	return ret;
+}
+
+/*
+ * Parses @req whole, then by fragments of every size, and checks that
+ * the status and everything the parser recorded are the same every time.
+ * The whole parse is left in @p.
+ * */
+static enum http_parse_status parse(const char *name, const char *req,
+		struct http_parser *p) {
+	unsigned int len = strlen(req), chunk;
+	enum http_parse_status ret, ret2;
+	struct http_parser p2;
+
+	ret = parse_chunked(p, req, len, len ? len : 1);
+
+	for(chunk = 1; chunk < len; chunk++) {
+		ret2 = parse_chunked(&p2, req, len, chunk);
+
+		CHECK(ret2 == ret);
+		if(ret2 != ret || ret != HTTP_PARSE_DONE) {
+			continue;
+		}
+
+		CHECK(p2.off == p->off);
+		CHECK(p2.method_len == p->method_len);
+		CHECK(p2.path_off == p->path_off);
+		CHECK(p2.path_len == p->path_len);
+		CHECK(p2.version_minor == p->version_minor);
+		CHECK(p2.connection == p->connection);
+		CHECK(p2.content_length == p->content_length);
+		CHECK(p2.transfer_encoding == p->transfer_encoding);
+		CHECK(p2.if_none_match.len == p->if_none_match.len);
+		CHECK(p2.if_none_match.len == 0 ||
+				p2.if_none_match.off == p->if_none_match.off);
+		CHECK(p2.accept_encoding.len == p->accept_encoding.len);
+		CHECK(p2.accept_encoding.len == 0 ||
+				p2.accept_encoding.off == p->accept_encoding.off);
+	}
+
+	return ret;
+}
+
+static int span_equal(const char *req, const struct http_span *span,
+		const char *value) {
+	return span->len == strlen(value) &&
+		!memcmp(req + span->off, value, span->len);
+}
+
+static void test_request_line(void) {
+	const char *name = "request line";
+	const char *req = "GET /hello HTTP/1.1\r\n\r\n";
+	struct http_parser p;
+
+	CHECK(parse(name, req, &p) == HTTP_PARSE_DONE);
+	CHECK(p.off == strlen(req));
+	CHECK(p.method_len == 3);
+	CHECK(p.path_len == 6 && !memcmp(req + p.path_off, "/hello", 6));
+	CHECK(p.version_minor == 1);
+	CHECK(p.content_length == -1);
+	CHECK(!p.transfer_encoding);
+	CHECK(http_parser_keep_alive(&p));
+
+	name = "incomplete";
+	CHECK(parse(name, "GET /hello HTTP/1.1\r\nHost: a\r\n", &p) ==
+			HTTP_PARSE_AGAIN);
+	CHECK(parse(name, "", &p) == HTTP_PARSE_AGAIN);
+
+	name = "malformed request line";
+	CHECK(parse(name, " / HTTP/1.1\r\n\r\n", &p) == HTTP_PARSE_ERROR);
+	CHECK(parse(name, "GET  HTTP/1.1\r\n\r\n", &p) == HTTP_PARSE_ERROR);
+	CHECK(parse(name, "GET / HTTP/2.0\r\n\r\n", &p) == HTTP_PARSE_ERROR);
+	CHECK(parse(name, "GET / HTTP/1.x\r\n\r\n", &p) == HTTP_PARSE_ERROR);
+	CHECK(parse(name, "GET / HTTP/1.1 \r\n\r\n", &p) == HTTP_PARSE_ERROR);
+	CHECK(parse(name, "GET /\x7f HTTP/1.1\r\n\r\n", &p) ==
+			HTTP_PARSE_ERROR);
+	CHECK(parse(name, "G(T / HTTP/1.1\r\n\r\n", &p) == HTTP_PARSE_ERROR);
+}
+
+static void test_bare_lf(void) {
+	const char *name = "bare LF";
+	struct http_parser p;
+
+	CHECK(parse(name, "GET / HTTP/1.1\n\n", &p) == HTTP_PARSE_ERROR);
+	CHECK(parse(name, "GET / HTTP/1.1\r\nHost: a\n\r\n", &p) ==
+			HTTP_PARSE_ERROR);
+	CHECK(parse(name, "GET / HTTP/1.1\r\nHost: a\r\n\n", &p) ==
+			HTTP_PARSE_ERROR);
+	CHECK(parse(name, "GET / HTTP/1.1\r\nConnection: close\n\r\n", &p) ==
+			HTTP_PARSE_ERROR);
+	CHECK(parse(name, "GET / HTTP/1.1\r\nIf-None-Match: \"a\"\n\r\n",
+				&p) == HTTP_PARSE_ERROR);
+	CHECK(parse(name, "GET / HTTP/1.1\r\nContent-Length: 0\n\r\n", &p) ==
+			HTTP_PARSE_ERROR);
+	CHECK(parse(name, "GET / HTTP/1.1\r\r\n\r\n", &p) == HTTP_PARSE_ERROR);
+}
+
+static void test_folding(void) {
+	const char *name = "folding";
+	struct http_parser p;
+
+	CHECK(parse(name, "GET / HTTP/1.1\r\nHost: a\r\n b\r\n\r\n", &p) ==
+			HTTP_PARSE_ERROR);
+	CHECK(parse(name, "GET / HTTP/1.1\r\nHost: a\r\n\tb\r\n\r\n", &p) ==
+			HTTP_PARSE_ERROR);
+	CHECK(parse(name, "GET / HTTP/1.1\r\nConnection: keep-alive\r\n"
+				" close\r\n\r\n", &p) == HTTP_PARSE_ERROR);
+
+	name = "malformed header";
+	CHECK(parse(name, "GET / HTTP/1.1\r\n: a\r\n\r\n", &p) ==
+			HTTP_PARSE_ERROR);
+	CHECK(parse(name, "GET / HTTP/1.1\r\nHost : a\r\n\r\n", &p) ==
+			HTTP_PARSE_ERROR);
+	CHECK(parse(name, "GET / HTTP/1.1\r\nHost: a\001b\r\n\r\n", &p) ==
+			HTTP_PARSE_ERROR);
+}
+
+/*
+ * Lines much longer than the names and tokens the parser matches.
+ * */
+static void test_overlong_lines(void) {
+	const char *name = "overlong path";
+	struct http_parser p;
+	char req[8192];
+	int n;
+
+	n = sprintf(req, "GET /");
+	memset(req + n, 'a', 4000);
+	n += 4000;
+	sprintf(req + n, " HTTP/1.1\r\n\r\n");
+	CHECK(parse(name, req, &p) == HTTP_PARSE_DONE);
+	CHECK(p.path_len == 4001);
+
+	name = "overlong header name";
+	n = sprintf(req, "GET / HTTP/1.1\r\nConnection");
+	memset(req + n, 'x', 3000);
+	n += 3000;
+	sprintf(req + n, ": close\r\n\r\n");
+	CHECK(parse(name, req, &p) == HTTP_PARSE_DONE);
+	CHECK(p.connection == HTTP_CONNECTION_UNSET);
+
+	name = "overlong header value";
+	n = sprintf(req, "GET / HTTP/1.1\r\nIf-None-Match: \"");
+	memset(req + n, 'e', 3000);
+	n += 3000;
+	sprintf(req + n, "\"  \r\nX-Padding: ");
+	n = strlen(req);
+	memset(req + n, 'p', 3000);
+	n += 3000;
+	sprintf(req + n, "\r\n\r\n");
+	CHECK(parse(name, req, &p) == HTTP_PARSE_DONE);
+	CHECK(p.if_none_match.len == 3002);
+	CHECK(req[p.if_none_match.off] == '"');
+	CHECK(req[p.if_none_match.off + p.if_none_match.len - 1] == '"');
+
+	name = "overlong Connection token";
+	n = sprintf(req, "GET / HTTP/1.1\r\nConnection: close");
+	memset(req + n, 'd', 3000);
+	n += 3000;
+	sprintf(req + n, "\r\n\r\n");
+	CHECK(parse(name, req, &p) == HTTP_PARSE_DONE);
+	CHECK(p.connection == HTTP_CONNECTION_UNSET);
+
+	name = "overlong Content-Length";
+	n = sprintf(req, "GET / HTTP/1.1\r\nContent-Length: ");
+	memset(req + n, '9', 3000);
+	n += 3000;
+	sprintf(req + n, "\r\n\r\n");
+	CHECK(parse(name, req, &p) == HTTP_PARSE_DONE);
+	CHECK(p.content_length == HTTP_CONTENT_LENGTH_MAX);
+}
+
+static void test_connection(void) {
+	static const struct {
+		const char *req;
+		enum http_connection connection;
+		bool keep_alive;
+	} cases[] = {
+		{ "GET / HTTP/1.1\r\n\r\n", HTTP_CONNECTION_UNSET, true },
+		{ "GET / HTTP/1.0\r\n\r\n", HTTP_CONNECTION_UNSET, false },
+		{ "GET / HTTP/1.1\r\nConnection: close\r\n\r\n",
+			HTTP_CONNECTION_CLOSE, false },
+		{ "GET / HTTP/1.0\r\nConnection: keep-alive\r\n\r\n",
+			HTTP_CONNECTION_KEEP_ALIVE, true },
+		{ "GET / HTTP/1.0\r\nconnection:Keep-Alive\r\n\r\n",
+			HTTP_CONNECTION_KEEP_ALIVE, true },
+		{ "GET / HTTP/1.1\r\nCONNECTION: CLOSE \r\n\r\n",
+			HTTP_CONNECTION_CLOSE, false },
+		{ "GET / HTTP/1.1\r\nConnection: upgrade, close\r\n\r\n",
+			HTTP_CONNECTION_CLOSE, false },
+		{ "GET / HTTP/1.1\r\nConnection: close, keep-alive\r\n\r\n",
+			HTTP_CONNECTION_CLOSE, false },
+		{ "GET / HTTP/1.1\r\nConnection: keep-alive, close\r\n\r\n",
+			HTTP_CONNECTION_CLOSE, false },
+		{ "GET / HTTP/1.1\r\nConnection: close\r\n"
+			"Connection: keep-alive\r\n\r\n",
+			HTTP_CONNECTION_CLOSE, false },
+		{ "GET / HTTP/1.1\r\nConnection: closed\r\n\r\n",
+			HTTP_CONNECTION_UNSET, true },
+		{ "GET / HTTP/1.1\r\nConnection: clos\r\n\r\n",
+			HTTP_CONNECTION_UNSET, true },
+		{ "GET / HTTP/1.1\r\nConnection:\r\n\r\n",
+			HTTP_CONNECTION_UNSET, true },
+		{ "GET / HTTP/1.0\r\nConnection: ,,keep-alive,\r\n\r\n",
+			HTTP_CONNECTION_KEEP_ALIVE, true },
+		{ "GET / HTTP/1.1\r\nX-Connection: close\r\n\r\n",
+			HTTP_CONNECTION_UNSET, true },
+		{ "GET / HTTP/1.1\r\nConnectio: close\r\n\r\n",
+			HTTP_CONNECTION_UNSET, true },
+	};
+	const char *name = "Connection";
+	struct http_parser p;
+	unsigned int i;
+
+	for(i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+		CHECK(parse(name, cases[i].req, &p) == HTTP_PARSE_DONE);
+		CHECK(p.connection == cases[i].connection);
+		CHECK(http_parser_keep_alive(&p) == cases[i].keep_alive);
+	}
+}
+
+static void test_body(void) {
+	const char *name = "Content-Length";
+	struct http_parser p;
+
+	CHECK(parse(name, "POST / HTTP/1.1\r\nContent-Length: 24\r\n\r\n"
+				"GET /secret HTTP/1.1\r\n\r\n", &p) ==
+			HTTP_PARSE_DONE);
+	CHECK(p.off == 39);
+	CHECK(p.content_length == 24);
+
+	CHECK(parse(name, "GET / HTTP/1.1\r\ncontent-length:0\r\n\r\n", &p) ==
+			HTTP_PARSE_DONE);
+	CHECK(p.content_length == 0);
+	CHECK(parse(name, "GET / HTTP/1.1\r\nContent-Length: \t7 \r\n\r\n",
+				&p) == HTTP_PARSE_DONE);
+	CHECK(p.content_length == 7);
+
+	CHECK(parse(name, "GET / HTTP/1.1\r\nContent-Length:\r\n\r\n", &p) ==
+			HTTP_PARSE_ERROR);
+	CHECK(parse(name, "GET / HTTP/1.1\r\nContent-Length: 1 2\r\n\r\n",
+				&p) == HTTP_PARSE_ERROR);
+	CHECK(parse(name, "GET / HTTP/1.1\r\nContent-Length: 1,1\r\n\r\n",
+				&p) == HTTP_PARSE_ERROR);
+	CHECK(parse(name, "GET / HTTP/1.1\r\nContent-Length: -1\r\n\r\n",
+				&p) == HTTP_PARSE_ERROR);
+	CHECK(parse(name, "GET / HTTP/1.1\r\nContent-Length: 0x10\r\n\r\n",
+				&p) == HTTP_PARSE_ERROR);
+	CHECK(parse(name, "GET / HTTP/1.1\r\nContent-Length: 0\r\n"
+				"Content-Length: 0\r\n\r\n", &p) ==
+			HTTP_PARSE_ERROR);
+
+	name = "Transfer-Encoding";
+	CHECK(parse(name, "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n"
+				"\r\n", &p) == HTTP_PARSE_DONE);
+	CHECK(p.transfer_encoding);
+	CHECK(p.content_length == -1);
+	CHECK(parse(name, "POST / HTTP/1.1\r\nContent-Length: 3\r\n"
+				"Transfer-Encoding: gzip, chunked\r\n\r\n", &p) ==
+			HTTP_PARSE_DONE);
+	CHECK(p.transfer_encoding);
+	CHECK(p.content_length == 3);
+	CHECK(parse(name, "GET / HTTP/1.1\r\nTransfer-Encodings: x\r\n\r\n",
+				&p) == HTTP_PARSE_DONE);
+	CHECK(!p.transfer_encoding);
+}
+
+static void test_captured(void) {
+	const char *name = "captured values";
+	const char *req = "GET / HTTP/1.1\r\n"
+		"If-None-Match:  \"a\", W/\"b\" \t\r\n"
+		"Accept-Encoding: gzip;q=0.5, deflate\r\n"
+		"If-Modified-Since: Sun, 06 Nov 1994 08:49:37 GMT\r\n\r\n";
+	struct http_parser p;
+
+	CHECK(parse(name, req, &p) == HTTP_PARSE_DONE);
+	CHECK(span_equal(req, &p.if_none_match, "\"a\", W/\"b\""));
+	CHECK(span_equal(req, &p.accept_encoding, "gzip;q=0.5, deflate"));
+	CHECK(span_equal(req, &p.if_modified_since,
+				"Sun, 06 Nov 1994 08:49:37 GMT"));
+
+	name = "last captured value wins";
+	req = "GET / HTTP/1.1\r\nIf-None-Match: \"a\"\r\n"
+		"If-None-Match: \"b\"\r\n\r\n";
+	CHECK(parse(name, req, &p) == HTTP_PARSE_DONE);
+	CHECK(span_equal(req, &p.if_none_match, "\"b\""));
+
+	name = "empty captured value";
+	req = "GET / HTTP/1.1\r\nAccept-Encoding: \r\n\r\n";
+	CHECK(parse(name, req, &p) == HTTP_PARSE_DONE);
+	CHECK(p.accept_encoding.len == 0);
+}
+
+/*
+ * Requests pipelined in one buffer, parsed one after the other from the
+ * end of the previous one, as http_parse_batch() does. */
+static void test_pipelined(void) {
+	const char *name = "pipelined";
+	const char *buf = "GET /a HTTP/1.1\r\n\r\n"
+		"GET /bb HTTP/1.1\r\nConnection: close\r\n\r\n"
+		"GET /ccc HTTP/1.1\r\n";
+	unsigned int head = 0, len = strlen(buf);
+	struct http_parser p;
+
+	http_parser_init(&p);
+	CHECK(http_parse(&p, buf + head, len - head) == HTTP_PARSE_DONE);
+	CHECK(p.path_len == 2 && http_parser_keep_alive(&p));
+	head += p.off;
+
+	http_parser_init(&p);
+	CHECK(http_parse(&p, buf + head, len - head) == HTTP_PARSE_DONE);
+	CHECK(p.path_len == 3 && !http_parser_keep_alive(&p));
+	head += p.off;
+
+	http_parser_init(&p);
+	CHECK(http_parse(&p, buf + head, len - head) == HTTP_PARSE_AGAIN);
+	CHECK(p.off == len - head);
+}
+
+int main(void) {
+	test_request_line();
+	test_bare_lf();
+	test_folding();
+	test_overlong_lines();
+	test_connection();
+	test_body();
+	test_captured();
+	test_pipelined();
+
+	if(failures) {
+		fprintf(stderr, "%d of %d checks failed\n", failures, checks);
+		return EXIT_FAILURE;
+	}
+
+	printf("%d checks passed\n", checks);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,530 @@
+/*
+ * Userspace build of the http_server_rcu model on liburcu.
+ *
+ * The model is the one of the module, http_server_model.h, built on
+ * kernel_compat.h: the same versions of server.content, client read
+ * section, updater, shadow copy recovery and benchmark updater, with
+ * pthreads in place of kthreads, so that the workload and the benchmark
+ * can be run as a normal process under perf and the sanitizers.
+ *
+ * RCU is the only synchronization backend, and there is no network path,
+ * hence nothing to render versions into. Tracepoints are printed with -v,
+ * the statistics at exit.
+ * */
+#include "kernel_compat.h"
+
+#include <inttypes.h>
+#include <sched.h>
+#include <unistd.h>
+
+#define TIME_TO_RECOVER 25
+#define TIME_BEFORE_RECOVERY 60
+#define NUM_CLIENTS 3
+#define TIMEOUT_MULTIPLIER 5
+#define UPDATE_FREQUENCY 20
+
+/*
+ * Versions are only looked at by the model, nothing is rendered.
+ * */
+struct web_data_render {
+};
+
+struct server {
+	struct content_set	__rcu	*content;
+	struct state		__rcu	*state;
+	struct time		__rcu	*update_timestamp;
+};
+
+/*
+ * Counterpart of struct client and struct bench_thread. */
+struct thread {
+	pthread_t	tid;
+	int		id;
+	int		cpu;
+	uint64_t	ops;
+};
+
+static struct server server;
+static pthread_mutex_t server_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static bool bench_running;
+static uint64_t grace_periods;
+static struct rcu_head gp_probe;
+
+static unsigned int num_clients = NUM_CLIENTS;
+static unsigned int timeout_multiplier = TIMEOUT_MULTIPLIER;
+static unsigned int update_frequency = UPDATE_FREQUENCY;
+static unsigned int time_before_recovery = TIME_BEFORE_RECOVERY;
+static unsigned int time_to_recover = TIME_TO_RECOVER;
+static unsigned int update_batch = 1;
+static unsigned int reclaim_backlog_max = 1024;
+static unsigned int run_duration;
+static unsigned int bench_duration;
+static unsigned int bench_readers;
+static unsigned int bench_updaters = 1;
+static bool verbose;
+
+/*
+ * liburcu has no expedited grace periods. */
+static bool recovery_expedited;
+
+static inline void trace_response_sent(int id, int status, int message) {
+	if(verbose) {
+		printf("Data:\nid: %d\nStatus Code: %d\nMode: Normal\nData: %d\n",
+				id, status, message);
+	}
+}
+
+static inline void trace_recovery_response(int id) {
+	if(verbose) {
+		printf("Data:\nid: %d\nStatus Code: 438\nMode: Recovery\n", id);
+	}
+}
+
+static inline void trace_web_data_updated(int old_message, int message) {
+	if(verbose) {
+		printf("Updated: %d -> %d\n", old_message, message);
+	}
+}
+
+#include "../http_server_model.h"
+
+static inline struct web_data *alloc_web_data(void) {
+	return malloc(sizeof(struct web_data));
+}
+
+static inline void free_web_data_now(struct web_data *web_data) {
+	free(web_data);
+}
+
+static inline int render_web_data(struct web_data *web_data,
+		const struct content_txn *txn) {
+	web_data->version = txn->new->generation;
+	return 0;
+}
+
+/*
+ * The rcu backend of the module, with server_mutex a pthread mutex and
+ * liburcu grace periods, which cannot be polled.
+ * */
+static void rcu_sync_read_lock(struct sync_read_ctx *ctx) {
+	rcu_read_lock();
+}
+
+static bool rcu_sync_read_unlock(struct sync_read_ctx *ctx) {
+	rcu_read_unlock();
+	return false;
+}
+
+static void rcu_sync_write_lock(void) {
+	pthread_mutex_lock(&server_mutex);
+}
+
+static void rcu_sync_write_unlock(void) {
+	pthread_mutex_unlock(&server_mutex);
+}
+
+/*
+ * Only used by rcu_dereference_protected(), which checks nothing here. */
+static bool rcu_sync_write_held(void) {
+	return true;
+}
+
+static unsigned long rcu_sync_start_synchronize(bool expedited) {
+	return 0;
+}
+
+static void rcu_sync_cond_synchronize(unsigned long cookie,
+		bool expedited) {
+	synchronize_rcu();
+}
+
+static const struct sync_ops rcu_sync_ops = {
+	.name		= "rcu",
+	.read_lock	= rcu_sync_read_lock,
+	.read_unlock	= rcu_sync_read_unlock,
+	.write_lock	= rcu_sync_write_lock,
+	.write_unlock	= rcu_sync_write_unlock,
+	.write_held	= rcu_sync_write_held,
+	.start_synchronize = rcu_sync_start_synchronize,
+	.cond_synchronize = rcu_sync_cond_synchronize,
+};
+
+static const struct sync_ops *sync_ops = &rcu_sync_ops;
+
+/*
+ * Sum of the statistics of the threads which exited, every thread running
+ * the model adds its own with http_stats_flush() before exiting.
+ * */
+static struct http_stats http_stats_total;
+static pthread_mutex_t http_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Every field of struct http_stats is a u64 counter. */
+static inline void http_stats_flush(void) {
+	u64 *total = (u64 *)&http_stats_total;
+	const u64 *stats = (const u64 *)&http_stats;
+	int i;
+
+	pthread_mutex_lock(&http_stats_lock);
+	for(i = 0; i < sizeof(http_stats) / sizeof(u64); i++) {
+		total[i] += stats[i];
+	}
+	pthread_mutex_unlock(&http_stats_lock);
+}
+
+static void *setup_client(void *data) {
+	struct thread *thread = data;
+	int timeout = thread->id * timeout_multiplier;
+
+	rcu_register_thread();
+
+	while(!READ_ONCE(should_stop)) {
+		client_read(thread->id);
+
+		msleep_interruptible(timeout*1000);
+	}
+
+	http_stats_flush();
+	rcu_unregister_thread();
+
+	return NULL;
+}
+
+static void *updater_thread(void *data) {
+	unsigned int pending = 0;
+
+	rcu_register_thread();
+
+	while(!READ_ONCE(should_stop)) {
+		updater_step(&pending);
+
+		msleep_interruptible(update_frequency*1000);
+	}
+
+	http_stats_flush();
+	rcu_unregister_thread();
+
+	return NULL;
+}
+
+static void *recover_system_thread(void *data) {
+	rcu_register_thread();
+
+	msleep_interruptible(time_before_recovery*1000);
+	if(!READ_ONCE(should_stop)) {
+		recover_system();
+	}
+
+	http_stats_flush();
+	rcu_unregister_thread();
+
+	return NULL;
+}
+
+static inline void bind_thread(struct thread *thread, int cpu) {
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	pthread_setaffinity_np(thread->tid, sizeof(set), &set);
+	thread->cpu = cpu;
+}
+
+static void bench_gp_probe(struct rcu_head *head) {
+	grace_periods++;
+
+	if(CMM_LOAD_SHARED(bench_running)) {
+		call_rcu(head, bench_gp_probe);
+	}
+}
+
+static void *bench_reader_thread(void *data) {
+	struct thread *thread = data;
+	uint64_t ops = 0;
+
+	rcu_register_thread();
+
+	while(CMM_LOAD_SHARED(bench_running)) {
+		client_read(thread->id);
+		ops++;
+	}
+
+	thread->ops = ops;
+	http_stats_flush();
+	rcu_unregister_thread();
+
+	return NULL;
+}
+
+static void *bench_updater_thread(void *data) {
+	struct thread *thread = data;
+	uint64_t ops = 0;
+
+	rcu_register_thread();
+
+	while(CMM_LOAD_SHARED(bench_running)) {
+		ops += bench_updater_step();
+	}
+
+	thread->ops = ops;
+	http_stats_flush();
+	rcu_unregister_thread();
+
+	return NULL;
+}
+
+static inline uint64_t rate(uint64_t ops, uint64_t elapsed_ns) {
+	return elapsed_ns ? (uint64_t)((double)ops * 1e9 / elapsed_ns) : 0;
+}
+
+/*
+ * Benchmark mode, see bench_thread() in the module.
+ * */
+static inline int run_bench(void) {
+	struct thread *readers, *updaters;
+	uint64_t start, elapsed, reads = 0, nr_updates = 0;
+	cpu_set_t online;
+	int i, cpu = -1, nr_cpus;
+
+	if(bench_readers == 0) {
+		bench_readers = sysconf(_SC_NPROCESSORS_ONLN);
+	}
+
+	readers = calloc(bench_readers, sizeof(*readers));
+	updaters = calloc(bench_updaters, sizeof(*updaters));
+	if(readers == NULL || updaters == NULL) {
+		free(readers);
+		free(updaters);
+		return -ENOMEM;
+	}
+
+	sched_getaffinity(0, sizeof(online), &online);
+	nr_cpus = CPU_SETSIZE;
+
+	CMM_STORE_SHARED(bench_running, true);
+	call_rcu(&gp_probe, bench_gp_probe);
+	start = local_clock();
+
+	for(i = 0; i < bench_readers; i++) {
+		do {
+			cpu = (cpu + 1) % nr_cpus;
+		} while(!CPU_ISSET(cpu, &online));
+
+		readers[i].id = i;
+		pthread_create(&readers[i].tid, NULL, bench_reader_thread,
+				&readers[i]);
+		bind_thread(&readers[i], cpu);
+	}
+
+	for(i = 0; i < bench_updaters; i++) {
+		updaters[i].id = i;
+		updaters[i].cpu = -1;
+		pthread_create(&updaters[i].tid, NULL, bench_updater_thread,
+				&updaters[i]);
+	}
+
+	msleep_interruptible(bench_duration*1000);
+
+	CMM_STORE_SHARED(bench_running, false);
+	elapsed = local_clock() - start;
+
+	for(i = 0; i < bench_readers; i++) {
+		pthread_join(readers[i].tid, NULL);
+		reads += readers[i].ops;
+		printf("bench reader %d cpu %d: %" PRIu64 " reads/s\n", i,
+				readers[i].cpu, rate(readers[i].ops, elapsed));
+	}
+
+	for(i = 0; i < bench_updaters; i++) {
+		pthread_join(updaters[i].tid, NULL);
+		nr_updates += updaters[i].ops;
+	}
+
+	/*
+	 * Let the grace period probe see bench_running cleared.
+	 * */
+	rcu_barrier();
+
+	printf("bench %u readers %u updaters %" PRIu64 " ms: %" PRIu64 " reads/s %" PRIu64 " updates/s %" PRIu64 " grace periods\n",
+			bench_readers, bench_updaters, elapsed / 1000000,
+			rate(reads, elapsed), rate(nr_updates, elapsed),
+			grace_periods);
+
+	free(readers);
+	free(updaters);
+
+	return 0;
+}
+
+/*
+ * Normal mode: clients, updater and recovery until SIGINT or for
+ * run_duration seconds.
+ * */
+static inline int run_simulation(void) {
+	struct thread *clients, updater = { 0 }, recovery = { 0 };
+	int i;
+
+	clients = calloc(num_clients, sizeof(*clients));
+	if(clients == NULL) {
+		return -ENOMEM;
+	}
+
+	for(i = 0; i < num_clients; i++) {
+		clients[i].id = i+1;
+		pthread_create(&clients[i].tid, NULL, setup_client, &clients[i]);
+	}
+
+	pthread_create(&recovery.tid, NULL, recover_system_thread, NULL);
+	pthread_create(&updater.tid, NULL, updater_thread, NULL);
+
+	if(run_duration) {
+		msleep_interruptible(run_duration*1000);
+		WRITE_ONCE(should_stop, 1);
+	}
+
+	for(i = 0; i < num_clients; i++) {
+		pthread_join(clients[i].tid, NULL);
+	}
+
+	pthread_join(recovery.tid, NULL);
+	pthread_join(updater.tid, NULL);
+
+	free(clients);
+
+	return 0;
+}
+
+/*
+ * Counterpart of the debugfs stats file of the module.
+ * */
+static inline void report_stats(void) {
+	struct http_stats *total = &http_stats_total;
+	int i;
+
+	printf("sync: %s\n", sync_ops->name);
+	printf("normal_responses: %" PRIu64 "\n", total->normal_responses);
+	printf("recovery_responses: %" PRIu64 "\n", total->recovery_responses);
+	printf("updates: %" PRIu64 "\n", total->updates);
+	printf("recoveries: %" PRIu64 "\n", total->recoveries);
+	printf("alloc_failures: %" PRIu64 "\n", total->alloc_failures);
+	printf("coalesced_updates: %" PRIu64 "\n", total->coalesced_updates);
+	printf("backlog_waits: %" PRIu64 "\n", total->backlog_waits);
+
+	if(total->recovery_gps[0]) {
+		printf("recovery_gp_normal: %" PRIu64 " recoveries, gp %" PRIu64 " ns, window %" PRIu64 " ns\n",
+				total->recovery_gps[0],
+				total->recovery_gp_ns[0] / total->recovery_gps[0],
+				total->recovery_window_ns[0] /
+					total->recovery_gps[0]);
+	}
+
+	printf("read_section_ns:\n");
+	for(i = 0; i < LATENCY_BUCKETS; i++) {
+		if(total->read_latency[i] == 0) {
+			continue;
+		}
+
+		printf("  [%llu, %llu): %" PRIu64 "\n", i ? 1ULL << i : 0,
+				1ULL << (i + 1), total->read_latency[i]);
+	}
+}
+
+static void handle_stop(int sig) {
+	WRITE_ONCE(should_stop, 1);
+}
+
+static void usage(const char *name) {
+	fprintf(stderr,
+		"usage: %s [-v] [-d seconds] [-c clients] [-m timeout_multiplier]\n"
+		"          [-u update_frequency] [-t time_before_recovery]\n"
+		"          [-T time_to_recover] [-n update_batch]\n"
+		"          [-l reclaim_backlog_max]\n"
+		"       %s -b bench_duration [-r readers] [-w updaters]\n"
+		"          [-n update_batch] [-l reclaim_backlog_max]\n",
+		name, name);
+}
+
+int main(int argc, char **argv) {
+	int opt, err;
+
+	while((opt = getopt(argc, argv, "vd:c:m:u:t:T:n:l:b:r:w:")) != -1) {
+		switch(opt) {
+		case 'v':
+			verbose = true;
+			break;
+		case 'd':
+			run_duration = strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			num_clients = strtoul(optarg, NULL, 0);
+			break;
+		case 'm':
+			timeout_multiplier = strtoul(optarg, NULL, 0);
+			break;
+		case 'u':
+			update_frequency = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			time_before_recovery = strtoul(optarg, NULL, 0);
+			break;
+		case 'T':
+			time_to_recover = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			update_batch = strtoul(optarg, NULL, 0);
+			break;
+		case 'l':
+			reclaim_backlog_max = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			bench_duration = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			bench_readers = strtoul(optarg, NULL, 0);
+			break;
+		case 'w':
+			bench_updaters = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if(update_batch == 0 || update_batch > UPDATE_BATCH_MAX) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	signal(SIGINT, handle_stop);
+	signal(SIGTERM, handle_stop);
+
+	rcu_register_thread();
+
+	if(initialize_state() || initialize_time() || initialize_web_data()) {
+		fprintf(stderr, "HTTP-SERVER: Not enough memory\n");
+		err = -ENOMEM;
+		goto out;
+	}
+
+	if(bench_duration) {
+		err = run_bench();
+	} else {
+		err = run_simulation();
+	}
+
+	report_stats();
+
+out:
+	rcu_unregister_thread();
+
+	/*
+	 * Wait for the versions still queued by content_txn_finish().
+	 * */
+	clean_up_content();
+	free(server.state);
+	free(server.update_timestamp);
+
+	return err ? 1 : 0;
+}
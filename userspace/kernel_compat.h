@@ -0,0 +1,198 @@
+/*
+ * The kernel facilities used by http_server_model.h, on liburcu and
+ * pthreads.
+ *
+ * Only what the model needs, with the closest userspace equivalent: the
+ * per CPU statistics are per thread, the recovery_mode static key is a
+ * plain flag, and http_srcu grace periods are RCU ones since the serving
+ * path, its only reader, is kernel only.
+ * */
+#ifndef KERNEL_COMPAT_H
+#define KERNEL_COMPAT_H
+
+#define _GNU_SOURCE
+#define _LGPL_SOURCE
+#include <urcu.h>
+#include <urcu/uatomic.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define SLEEP_SLICE_MS 100
+
+typedef uint32_t u32;
+typedef uint64_t u64;
+
+#define __rcu
+#define __read_mostly
+
+#define READ_ONCE(x) CMM_LOAD_SHARED(x)
+#define WRITE_ONCE(x, val) CMM_STORE_SHARED(x, val)
+#define container_of(ptr, type, member) caa_container_of(ptr, type, member)
+#define min(a, b) ((a) < (b) ? (a) : (b))
+
+#define KERN_INFO ""
+#define KERN_ERR ""
+#define printk(...) printf(__VA_ARGS__)
+
+/*
+ * Memory.
+ * */
+#define GFP_KERNEL 0
+
+#define kmalloc(size, gfp) malloc(size)
+#define kzalloc(size, gfp) calloc(1, size)
+#define kfree(ptr) free(ptr)
+#define struct_size(ptr, member, n) \
+	(sizeof(*(ptr)) + (n) * sizeof(*(ptr)->member))
+
+static inline void *kmemdup(const void *src, size_t len, int gfp) {
+	void *dst = malloc(len);
+
+	if(dst != NULL) {
+		memcpy(dst, src, len);
+	}
+
+	return dst;
+}
+
+/*
+ * Locking. Lockdep conditions are not checked.
+ * */
+struct mutex {
+	pthread_mutex_t lock;
+};
+
+#define DEFINE_MUTEX(name) struct mutex name = { PTHREAD_MUTEX_INITIALIZER }
+#define mutex_lock(mutex) pthread_mutex_lock(&(mutex)->lock)
+#define mutex_unlock(mutex) pthread_mutex_unlock(&(mutex)->lock)
+#define lockdep_is_held(lock) true
+
+typedef struct {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+} wait_queue_head_t;
+
+#define DECLARE_WAIT_QUEUE_HEAD(name) \
+	wait_queue_head_t name = { PTHREAD_MUTEX_INITIALIZER, \
+		PTHREAD_COND_INITIALIZER }
+
+static inline void wake_up_all(wait_queue_head_t *wq) {
+	pthread_mutex_lock(&wq->lock);
+	pthread_cond_broadcast(&wq->cond);
+	pthread_mutex_unlock(&wq->lock);
+}
+
+/*
+ * The condition is evaluated under the lock wake_up_all() takes, hence a
+ * wake up after it changed cannot be missed. */
+#define wait_event_interruptible(wq, condition) ({			\
+	pthread_mutex_lock(&(wq).lock);					\
+	while(!(condition)) {						\
+		pthread_cond_wait(&(wq).cond, &(wq).lock);		\
+	}								\
+	pthread_mutex_unlock(&(wq).lock);				\
+	0;								\
+})
+
+/*
+ * RCU. liburcu names the reader and updater primitives like the kernel.
+ * */
+typedef void (*rcu_callback_t)(struct rcu_head *head);
+
+#define rcu_dereference_protected(ptr, cond) (ptr)
+#define rcu_replace_pointer(ptr, new, cond) rcu_xchg_pointer(&(ptr), new)
+#define rcu_head_init(head) do { } while(0)
+
+struct srcu_struct {
+	int unused;
+};
+
+#define DEFINE_STATIC_SRCU(name) static struct srcu_struct name
+#define call_srcu(ssp, head, func) ((void)(ssp), call_rcu(head, func))
+#define srcu_barrier(ssp) ((void)(ssp), rcu_barrier())
+
+typedef struct {
+	long counter;
+} atomic_long_t;
+
+#define ATOMIC_LONG_INIT(i) { (i) }
+#define atomic_long_read(v) uatomic_read(&(v)->counter)
+#define atomic_long_add(i, v) uatomic_add(&(v)->counter, i)
+#define atomic_long_sub(i, v) uatomic_sub(&(v)->counter, i)
+
+/*
+ * Static keys and per CPU data.
+ * */
+struct static_key_false {
+	bool enabled;
+};
+
+#define DEFINE_STATIC_KEY_FALSE(name) struct static_key_false name = { false }
+#define static_branch_unlikely(key) caa_unlikely(CMM_LOAD_SHARED((key)->enabled))
+#define static_branch_enable(key) CMM_STORE_SHARED((key)->enabled, true)
+#define static_branch_disable(key) CMM_STORE_SHARED((key)->enabled, false)
+
+#define DEFINE_PER_CPU(type, name) __thread type name
+#define this_cpu_inc(var) ((var)++)
+#define this_cpu_add(var, val) ((var) += (val))
+
+/*
+ * Hashing and time.
+ *
+ * jhash() only has to spread paths over the content tree, FNV-1a does.
+ * */
+static inline u32 jhash(const void *key, u32 length, u32 initval) {
+	const unsigned char *p = key;
+	u32 hash = 2166136261U ^ initval;
+
+	while(length--) {
+		hash = (hash ^ *p++) * 16777619U;
+	}
+
+	return hash;
+}
+
+static inline u64 local_clock(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline int fls64(u64 x) {
+	return x ? 64 - __builtin_clzll(x) : 0;
+}
+
+/*
+ * Threads. should_stop is set on SIGINT and SIGTERM and stands for
+ * kthread_stop().
+ * */
+static volatile sig_atomic_t should_stop;
+
+/*
+ * msleep_interruptible() which also returns when the process is asked
+ * to stop, the equivalent of a kthread_stop() wake up.
+ * */
+static inline void msleep_interruptible(unsigned int ms) {
+	struct timespec ts;
+	unsigned int slice;
+
+	while(ms > 0 && !READ_ONCE(should_stop)) {
+		slice = ms < SLEEP_SLICE_MS ? ms : SLEEP_SLICE_MS;
+		ts.tv_sec = slice / 1000;
+		ts.tv_nsec = (slice % 1000) * 1000000L;
+		nanosleep(&ts, NULL);
+		ms -= slice;
+	}
+}
+
+#endif